@@ -0,0 +1,103 @@
+/*  Copyright 2013 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_PASSPORT_DETAIL_CHAIN_VALIDATOR_H_
+#define MAIDSAFE_PASSPORT_DETAIL_CHAIN_VALIDATOR_H_
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <type_traits>
+#include <utility>
+
+#include "maidsafe/common/rsa.h"
+#include "maidsafe/common/types.h"
+
+#include "maidsafe/passport/detail/config.h"
+#include "maidsafe/passport/detail/public_fob.h"
+
+
+namespace maidsafe {
+namespace passport {
+namespace detail {
+
+// Thread-safe validator for Anmaid -> Maid -> Pmid chains of trust.  For each link, the fob's name
+// is recomputed from its public key and validation token, and the validation token is checked
+// against the signer's public key.  Since a fob's name is the hash of its public key and token,
+// a pair of validated names identifies a link uniquely.  Such pairs are remembered (up to
+// max_cached_links, oldest first out) so that chains sharing an Anmaid or Maid only pay for the
+// signature checks of links which haven't been seen before.
+class ChainValidator {
+ public:
+  explicit ChainValidator(size_t max_cached_links = 10000);
+
+  bool Validate(const PublicFob<AnmaidTag>& anmaid,
+                const PublicFob<MaidTag>& maid,
+                const PublicFob<PmidTag>& pmid);
+  void Clear();
+  size_t CachedLinkCount() const;
+
+ private:
+  typedef std::pair<Identity, Identity> Link;  // signee name, signer name
+
+  ChainValidator(const ChainValidator&);
+  ChainValidator& operator=(const ChainValidator&);
+
+  template<typename Tag>
+  bool NameIsValid(const PublicFob<Tag>& public_fob) const;
+  template<typename Tag, typename SignerTag>
+  bool LinkIsValid(const PublicFob<Tag>& public_fob, const PublicFob<SignerTag>& signer);
+  bool IsCached(const Link& link) const;
+  void Cache(const Link& link);
+
+  const size_t kMaxCachedLinks_;
+  mutable std::mutex mutex_;
+  std::set<Link> verified_links_;
+  std::deque<Link> insertion_order_;
+};
+
+template<typename Tag>
+bool ChainValidator::NameIsValid(const PublicFob<Tag>& public_fob) const {
+  return CreateFobName(public_fob.public_key(), public_fob.validation_token()) ==
+         public_fob.name().value;
+}
+
+// Both names must already have been validated by the caller.
+template<typename Tag, typename SignerTag>
+bool ChainValidator::LinkIsValid(const PublicFob<Tag>& public_fob,
+                                 const PublicFob<SignerTag>& signer) {
+  static_assert(std::is_same<typename Signer<Tag>::type, Fob<SignerTag>>::value,
+                "Wrong signer type for this fob.");
+  Link link(std::make_pair(public_fob.name().value, signer.name().value));
+  if (IsCached(link))
+    return true;
+  typedef typename PublicFob<Tag>::scheme_type scheme_type;
+  if (!signer.Verify(asymm::PlainText(scheme_type::EncodeKey(public_fob.public_key())),
+                     public_fob.validation_token())) {
+    return false;
+  }
+  Cache(link);
+  return true;
+}
+
+}  // namespace detail
+}  // namespace passport
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_PASSPORT_DETAIL_CHAIN_VALIDATOR_H_
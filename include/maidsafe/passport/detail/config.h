@@ -45,6 +45,9 @@ typedef maidsafe::detail::Tag<DataTagValue::kMpidValue> MpidTag;
 template<typename Tag, class Enable = void>
 class Fob;
 
+template<typename Tag>
+class PublicFob;
+
 template<typename Tag>
 class MidData;
 
@@ -19,16 +19,19 @@
 #ifndef MAIDSAFE_PASSPORT_DETAIL_FOB_H_
 #define MAIDSAFE_PASSPORT_DETAIL_FOB_H_
 
+#include <memory>
 #include <type_traits>
 #include <string>
 #include <vector>
 
 #include "boost/filesystem/path.hpp"
 
+#include "maidsafe/common/crypto.h"
 #include "maidsafe/common/rsa.h"
 #include "maidsafe/common/types.h"
 
 #include "maidsafe/passport/detail/config.h"
+#include "maidsafe/passport/detail/signature_scheme.h"
 
 
 namespace maidsafe {
@@ -37,19 +40,36 @@ namespace detail {
 
 namespace protobuf { class Fob; }
 
-Identity CreateFobName(const asymm::PublicKey& public_key,
+Identity CreateFobName(const RsaScheme::PublicKey& public_key,
                        const asymm::Signature& validation_token);
+Identity CreateFobName(const EcdsaScheme::PublicKey& public_key,
+                       const asymm::Signature& validation_token);
+
+// Equivalent to calling CreateFobName for each pair of public_keys[i] and validation_tokens[i].
+// Large batches are spread across the available hardware threads.
+std::vector<Identity> CreateFobNames(const std::vector<asymm::PublicKey>& public_keys,
+                                     const std::vector<asymm::Signature>& validation_tokens);
 
 Identity CreateMpidName(const NonEmptyString& chosen_name);
 
 void FobFromProtobuf(const protobuf::Fob& proto_fob,
                      DataTagValue enum_value,
-                     asymm::Keys& keys,
+                     RsaScheme::Keys& keys,
+                     asymm::Signature& validation_token,
+                     Identity& name);
+void FobFromProtobuf(const protobuf::Fob& proto_fob,
+                     DataTagValue enum_value,
+                     EcdsaScheme::Keys& keys,
                      asymm::Signature& validation_token,
                      Identity& name);
 
 void FobToProtobuf(DataTagValue enum_value,
-                   const asymm::Keys& keys,
+                   const RsaScheme::Keys& keys,
+                   const asymm::Signature& validation_token,
+                   const std::string& name,
+                   protobuf::Fob* proto_fob);
+void FobToProtobuf(DataTagValue enum_value,
+                   const EcdsaScheme::Keys& keys,
                    const asymm::Signature& validation_token,
                    const std::string& name,
                    protobuf::Fob* proto_fob);
@@ -75,6 +95,7 @@ class Fob {
   typedef maidsafe::detail::Name<Fob> Name;
   typedef TagType Tag;
   typedef typename Signer<Tag>::type signer_type;
+  typedef typename SignatureScheme<Tag>::type scheme_type;
   Fob(const Fob& other);
   Fob& operator=(const Fob& other);
   Fob(Fob&& other);
@@ -83,13 +104,18 @@ class Fob {
   void ToProtobuf(protobuf::Fob* proto_fob) const;
   Name name() const;
   asymm::Signature validation_token() const;
-  asymm::PrivateKey private_key() const;
-  asymm::PublicKey public_key() const;
+  typename scheme_type::PrivateKey private_key() const;
+  typename scheme_type::PublicKey public_key() const;
+  asymm::Signature Sign(const asymm::PlainText& data) const;
+  std::vector<asymm::Signature> Sign(const std::vector<asymm::PlainText>& data) const;
+  asymm::Signature Sign(const asymm::PlainText& data, crypto::SHA512Hash& digest) const;
+  asymm::PlainText Decrypt(const asymm::CipherText& data) const;
 
  private:
-  asymm::Keys keys_;
+  typename scheme_type::Keys keys_;
   asymm::Signature validation_token_;
   Name name_;
+  std::shared_ptr<CachedSigner<scheme_type>> signer_;
 };
 
 template<typename TagType>
@@ -98,6 +124,7 @@ class Fob<TagType, typename std::enable_if<is_self_signed<TagType>::value>::type
   typedef maidsafe::detail::Name<Fob> Name;
   typedef TagType Tag;
   typedef typename Signer<Tag>::type signer_type;
+  typedef typename SignatureScheme<Tag>::type scheme_type;
   // This constructor is only available to this specialisation (i.e. self-signed fob)
   Fob();
   Fob(const Fob& other);
@@ -108,22 +135,39 @@ class Fob<TagType, typename std::enable_if<is_self_signed<TagType>::value>::type
   void ToProtobuf(protobuf::Fob* proto_fob) const;
   Name name() const { return name_; }
   asymm::Signature validation_token() const { return validation_token_; }
-  asymm::PrivateKey private_key() const { return keys_.private_key; }
-  asymm::PublicKey public_key() const { return keys_.public_key; }
+  typename scheme_type::PrivateKey private_key() const { return keys_.private_key; }
+  typename scheme_type::PublicKey public_key() const { return keys_.public_key; }
+  // Signing and decryption using this fob's private key, without copying the key out of the fob.
+  asymm::Signature Sign(const asymm::PlainText& data) const {
+    return signer_->Sign(keys_.private_key, data);
+  }
+  std::vector<asymm::Signature> Sign(const std::vector<asymm::PlainText>& data) const {
+    return signer_->Sign(keys_.private_key, data);
+  }
+  // Also sets 'digest' to the SHA-512 hash of 'data', taken from the signature's own hashing pass.
+  asymm::Signature Sign(const asymm::PlainText& data, crypto::SHA512Hash& digest) const {
+    return signer_->Sign(keys_.private_key, data, digest);
+  }
+  asymm::PlainText Decrypt(const asymm::CipherText& data) const {
+    return scheme_type::Decrypt(data, keys_.private_key);
+  }
 
  private:
-  asymm::Keys keys_;
+  typename scheme_type::Keys keys_;
   asymm::Signature validation_token_;
   Name name_;
+  std::shared_ptr<CachedSigner<scheme_type>> signer_;
 };
 
 // Default constructor (exclusive to self-signing fobs)
 template<typename Tag>
 Fob<Tag, typename std::enable_if<is_self_signed<Tag>::value>::type>::Fob()
-    : keys_(asymm::GenerateKeyPair()),
-      validation_token_(asymm::Sign(asymm::PlainText(asymm::EncodeKey(keys_.public_key)),
-                                    keys_.private_key)),
-      name_(CreateFobName(keys_.public_key, validation_token_)) {
+    : keys_(scheme_type::GenerateKeyPair()),
+      validation_token_(
+          scheme_type::Sign(asymm::PlainText(scheme_type::EncodeKey(keys_.public_key)),
+                            keys_.private_key)),
+      name_(CreateFobName(keys_.public_key, validation_token_)),
+      signer_(std::make_shared<CachedSigner<scheme_type>>()) {
   static_assert(std::is_same<Fob<Tag>, signer_type>::value,
                 "This constructor is only applicable for self-signing fobs.");
 }
@@ -133,7 +177,8 @@ Fob<Tag, typename std::enable_if<is_self_signed<Tag>::value>::type>::Fob(
     const Fob<Tag, typename std::enable_if<is_self_signed<Tag>::value>::type>& other)
         : keys_(other.keys_),
           validation_token_(other.validation_token_),
-          name_(other.name_) {}
+          name_(other.name_),
+          signer_(other.signer_) {}
 
 template<typename Tag>
 Fob<Tag, typename std::enable_if<is_self_signed<Tag>::value>::type>&
@@ -142,6 +187,7 @@ Fob<Tag, typename std::enable_if<is_self_signed<Tag>::value>::type>&
   keys_ = other.keys_;
   validation_token_ = other.validation_token_;
   name_ = other.name_;
+  signer_ = other.signer_;
   return *this;
 }
 
@@ -150,7 +196,8 @@ Fob<Tag, typename std::enable_if<is_self_signed<Tag>::value>::type>::Fob(
     Fob<Tag, typename std::enable_if<is_self_signed<Tag>::value>::type>&& other)
         : keys_(std::move(other.keys_)),
           validation_token_(std::move(other.validation_token_)),
-          name_(std::move(other.name_)) {}
+          name_(std::move(other.name_)),
+          signer_(other.signer_) {}
 
 template<typename Tag>
 Fob<Tag, typename std::enable_if<is_self_signed<Tag>::value>::type>&
@@ -159,12 +206,17 @@ Fob<Tag, typename std::enable_if<is_self_signed<Tag>::value>::type>&
   keys_ = std::move(other.keys_);
   validation_token_ = std::move(other.validation_token_);
   name_ = std::move(other.name_);
+  signer_ = other.signer_;
   return *this;
 }
 
 template<typename Tag>
 Fob<Tag, typename std::enable_if<is_self_signed<Tag>::value>::type>::Fob(
-    const protobuf::Fob& proto_fob) : keys_(), validation_token_(), name_() {
+    const protobuf::Fob& proto_fob)
+        : keys_(),
+          validation_token_(),
+          name_(),
+          signer_(std::make_shared<CachedSigner<scheme_type>>()) {
   Identity name;
   FobFromProtobuf(proto_fob, Tag::kValue, keys_, validation_token_, name);
   name_ = Name(name);
@@ -183,6 +235,7 @@ class Fob<MpidTag> {
   typedef maidsafe::detail::Name<Fob> Name;
   typedef MpidTag Tag;
   typedef Signer<MpidTag>::type signer_type;
+  typedef SignatureScheme<MpidTag>::type scheme_type;
   Fob(const Fob& other);
   // This constructor is only available to this specialisation (i.e. Mpid)
   Fob(const NonEmptyString& chosen_name, const signer_type& signing_fob);
@@ -193,14 +246,29 @@ class Fob<MpidTag> {
   void ToProtobuf(protobuf::Fob* proto_fob) const;
   Name name() const { return name_; }
   asymm::Signature validation_token() const { return validation_token_; }
-  asymm::PrivateKey private_key() const { return keys_.private_key; }
-  asymm::PublicKey public_key() const { return keys_.public_key; }
+  scheme_type::PrivateKey private_key() const { return keys_.private_key; }
+  scheme_type::PublicKey public_key() const { return keys_.public_key; }
+  // Signing and decryption using this fob's private key, without copying the key out of the fob.
+  asymm::Signature Sign(const asymm::PlainText& data) const {
+    return signer_->Sign(keys_.private_key, data);
+  }
+  std::vector<asymm::Signature> Sign(const std::vector<asymm::PlainText>& data) const {
+    return signer_->Sign(keys_.private_key, data);
+  }
+  // Also sets 'digest' to the SHA-512 hash of 'data', taken from the signature's own hashing pass.
+  asymm::Signature Sign(const asymm::PlainText& data, crypto::SHA512Hash& digest) const {
+    return signer_->Sign(keys_.private_key, data, digest);
+  }
+  asymm::PlainText Decrypt(const asymm::CipherText& data) const {
+    return scheme_type::Decrypt(data, keys_.private_key);
+  }
 
  private:
   Fob();
-  asymm::Keys keys_;
+  scheme_type::Keys keys_;
   asymm::Signature validation_token_;
   Name name_;
+  std::shared_ptr<CachedSigner<scheme_type>> signer_;
 };
 
 
@@ -210,6 +278,7 @@ class Fob<TagType, typename std::enable_if<!is_self_signed<TagType>::value>::typ
   typedef maidsafe::detail::Name<Fob> Name;
   typedef TagType Tag;
   typedef typename Signer<Tag>::type signer_type;
+  typedef typename SignatureScheme<Tag>::type scheme_type;
   Fob(const Fob& other);
   // This constructor is only available to this specialisation (i.e. non-self-signed fob)
   explicit Fob(const signer_type& signing_fob,
@@ -221,14 +290,29 @@ class Fob<TagType, typename std::enable_if<!is_self_signed<TagType>::value>::typ
   void ToProtobuf(protobuf::Fob* proto_fob) const;
   Name name() const { return name_; }
   asymm::Signature validation_token() const { return validation_token_; }
-  asymm::PrivateKey private_key() const { return keys_.private_key; }
-  asymm::PublicKey public_key() const { return keys_.public_key; }
+  typename scheme_type::PrivateKey private_key() const { return keys_.private_key; }
+  typename scheme_type::PublicKey public_key() const { return keys_.public_key; }
+  // Signing and decryption using this fob's private key, without copying the key out of the fob.
+  asymm::Signature Sign(const asymm::PlainText& data) const {
+    return signer_->Sign(keys_.private_key, data);
+  }
+  std::vector<asymm::Signature> Sign(const std::vector<asymm::PlainText>& data) const {
+    return signer_->Sign(keys_.private_key, data);
+  }
+  // Also sets 'digest' to the SHA-512 hash of 'data', taken from the signature's own hashing pass.
+  asymm::Signature Sign(const asymm::PlainText& data, crypto::SHA512Hash& digest) const {
+    return signer_->Sign(keys_.private_key, data, digest);
+  }
+  asymm::PlainText Decrypt(const asymm::CipherText& data) const {
+    return scheme_type::Decrypt(data, keys_.private_key);
+  }
 
  private:
   Fob();
-  asymm::Keys keys_;
+  typename scheme_type::Keys keys_;
   asymm::Signature validation_token_;
   Name name_;
+  std::shared_ptr<CachedSigner<scheme_type>> signer_;
 };
 
 template<typename Tag>
@@ -236,17 +320,19 @@ Fob<Tag, typename std::enable_if<!is_self_signed<Tag>::value>::type>::Fob(
     const Fob<Tag, typename std::enable_if<!is_self_signed<Tag>::value>::type>& other)
         : keys_(other.keys_),
           validation_token_(other.validation_token_),
-          name_(other.name_) {}
+          name_(other.name_),
+          signer_(other.signer_) {}
 
 // Explicit constructor initialising with different signing fob (exclusive to non-self-signing fobs)
 template<typename Tag>
 Fob<Tag, typename std::enable_if<!is_self_signed<Tag>::value>::type>::Fob(
     const signer_type& signing_fob,
     typename std::enable_if<!std::is_same<Fob<Tag>, signer_type>::value>::type*)
-        : keys_(asymm::GenerateKeyPair()),
-          validation_token_(asymm::Sign(asymm::PlainText(asymm::EncodeKey(keys_.public_key)),
-                                        signing_fob.private_key())),
-          name_(CreateFobName(keys_.public_key, validation_token_)) {}
+        : keys_(scheme_type::GenerateKeyPair()),
+          validation_token_(
+              signing_fob.Sign(asymm::PlainText(scheme_type::EncodeKey(keys_.public_key)))),
+          name_(CreateFobName(keys_.public_key, validation_token_)),
+          signer_(std::make_shared<CachedSigner<scheme_type>>()) {}
 
 template<typename Tag>
 Fob<Tag, typename std::enable_if<!is_self_signed<Tag>::value>::type>&
@@ -255,6 +341,7 @@ Fob<Tag, typename std::enable_if<!is_self_signed<Tag>::value>::type>&
   keys_ = other.keys_;
   validation_token_ = other.validation_token_;
   name_ = other.name_;
+  signer_ = other.signer_;
   return *this;
 }
 
@@ -263,7 +350,8 @@ Fob<Tag, typename std::enable_if<!is_self_signed<Tag>::value>::type>::Fob(
     Fob<Tag, typename std::enable_if<!is_self_signed<Tag>::value>::type>&& other)
         : keys_(std::move(other.keys_)),
           validation_token_(std::move(other.validation_token_)),
-          name_(std::move(other.name_)) {}
+          name_(std::move(other.name_)),
+          signer_(other.signer_) {}
 
 template<typename Tag>
 Fob<Tag, typename std::enable_if<!is_self_signed<Tag>::value>::type>&
@@ -272,12 +360,17 @@ Fob<Tag, typename std::enable_if<!is_self_signed<Tag>::value>::type>&
   keys_ = std::move(other.keys_);
   validation_token_ = std::move(other.validation_token_);
   name_ = std::move(other.name_);
+  signer_ = other.signer_;
   return *this;
 }
 
 template<typename Tag>
 Fob<Tag, typename std::enable_if<!is_self_signed<Tag>::value>::type>::Fob(
-    const protobuf::Fob& proto_fob) : keys_(), validation_token_(), name_() {
+    const protobuf::Fob& proto_fob)
+        : keys_(),
+          validation_token_(),
+          name_(),
+          signer_(std::make_shared<CachedSigner<scheme_type>>()) {
   Identity name;
   FobFromProtobuf(proto_fob, Tag::kValue, keys_, validation_token_, name);
   name_ = Name(name);
@@ -19,9 +19,17 @@
 #ifndef MAIDSAFE_PASSPORT_DETAIL_IDENTITY_DATA_H_
 #define MAIDSAFE_PASSPORT_DETAIL_IDENTITY_DATA_H_
 
+#include <chrono>
 #include <cstdint>
+#include <istream>
 #include <memory>
+#include <mutex>
+#include <ostream>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include "boost/utility/string_ref.hpp"
 
 #include "maidsafe/common/crypto.h"
 #include "maidsafe/common/rsa.h"
@@ -49,12 +57,58 @@ NonEmptyString MidToProtobuf(DataTagValue enum_value,
                              const EncryptedTmidName& encrypted_tmid_name,
                              const asymm::Signature& validation_token);
 
+// Validates a serialised Mid or Tmid without copying its fields, setting 'payload' (the encrypted
+// Tmid name or session) and 'validation_token' to refer into 'serialised_packet'.  Throws 'error'
+// if the packet is malformed, of a type other than 'enum_value', or has an empty field.
+void IdentityPacketView(const NonEmptyString& serialised_packet,
+                        DataTagValue enum_value,
+                        PassportErrors error,
+                        boost::string_ref& payload,
+                        boost::string_ref& validation_token);
+
 template<typename MidType>
 SecureString::Hash GenerateMidName(const Keyword& keyword,
                                    const Pin& pin);
 
 crypto::SHA512Hash HashOfPin(uint32_t pin);
 
+// The cost of the PBKDF2 derivations protecting a user's session and Tmid name.  kPinScaled is the
+// original scheme, where the iteration counts are taken from the numeric pin, so login CPU cost
+// varies widely between users.  kFixed uses the same explicit iteration count for every user.  The
+// policy is recorded alongside each encrypted session and Tmid name, so data written under any
+// policy, including the unversioned pin-scaled data written before policies existed, remains
+// decryptable.  Encryption defaults to kPinScaled everywhere, so that existing callers keep writing
+// data older clients can read; kFixed is only used when a policy is passed explicitly.
+struct KdfPolicy {
+  enum class Version : uint32_t { kPinScaled = 0, kFixed = 1 };
+
+  static const uint32_t kDefaultIterations = 10000;
+  static const uint32_t kMinimumIterations = 1000;
+
+  // kFixed with kDefaultIterations.
+  KdfPolicy();
+  // kFixed with the given iteration count, which must be at least kMinimumIterations.
+  explicit KdfPolicy(uint32_t iterations_in);
+  static KdfPolicy PinScaled();
+
+  Version version;
+  uint32_t iterations;
+};
+
+bool operator==(const KdfPolicy& lhs, const KdfPolicy& rhs);
+bool operator!=(const KdfPolicy& lhs, const KdfPolicy& rhs);
+
+// Compression applied to a session before it's encrypted.  This is recorded in the encrypted
+// session, so these values are persisted and must never be changed or reused.  Compression is only
+// available for the authenticated format, so is ignored under KdfPolicy::kPinScaled, and is skipped
+// for any session which it wouldn't make smaller.
+enum class SessionCompression : uint32_t { kNone = 0, kDeflate = 1 };
+
+// Measures PBKDF2 throughput on this host and returns a kFixed policy whose derivations each take
+// approximately 'target_latency'.  Since LoginContext runs its derivations concurrently, this is
+// also roughly the latency of a full login, while its CPU cost is around three times as much.
+KdfPolicy CalibrateKdfPolicy(std::chrono::milliseconds target_latency);
+
 
 template<typename TagType>
 class MidData {
@@ -127,8 +181,7 @@ MidData<Tag>::MidData(Name name, EncryptedTmidName encrypted_tmid_name,
                       signer_type signing_fob)
     : name_(std::move(name)),
       encrypted_tmid_name_(encrypted_tmid_name),
-      validation_token_(asymm::Sign(encrypted_tmid_name.data,
-                                    signing_fob.private_key())) {}
+      validation_token_(signing_fob.Sign(encrypted_tmid_name.data)) {}
 
 template<typename Tag>
 MidData<Tag>::MidData(const Name& name, const serialised_type& serialised_mid)
@@ -146,6 +199,42 @@ typename MidData<Tag>::serialised_type MidData<Tag>::Serialise() const {
 }
 
 
+// Non-owning view of a serialised MidData, for vaults which store and forward packets without
+// needing their contents.  The packet is validated on construction as for MidData, but the fields
+// refer into 'serialised_mid', which must outlive the view.
+template<typename TagType>
+class MidDataView {
+ public:
+  typedef typename MidData<TagType>::Name Name;
+  typedef TagType Tag;
+  typedef typename MidData<TagType>::serialised_type serialised_type;
+
+  MidDataView(const Name& name, const serialised_type& serialised_mid);
+
+  Name name() const { return name_; }
+  boost::string_ref encrypted_tmid_name() const { return encrypted_tmid_name_; }
+  boost::string_ref validation_token() const { return validation_token_; }
+
+ private:
+  MidDataView();
+  MidDataView(const Name& name, serialised_type&& serialised_mid);
+  Name name_;
+  boost::string_ref encrypted_tmid_name_;
+  boost::string_ref validation_token_;
+};
+
+template<typename Tag>
+MidDataView<Tag>::MidDataView(const Name& name, const serialised_type& serialised_mid)
+    : name_(name),
+      encrypted_tmid_name_(),
+      validation_token_() {
+  if (!name_->IsInitialised())
+    ThrowError(PassportErrors::mid_parsing_error);
+  IdentityPacketView(serialised_mid.data, Tag::kValue, PassportErrors::mid_parsing_error,
+                     encrypted_tmid_name_, validation_token_);
+}
+
+
 class TmidData {
  public:
   typedef maidsafe::detail::Name<TmidData> Name;
@@ -173,11 +262,56 @@ class TmidData {
   asymm::Signature validation_token_;
 };
 
+// Non-owning view of a serialised TmidData; see MidDataView.
+class TmidDataView {
+ public:
+  typedef TmidData::Name Name;
+  typedef TmidData::Tag Tag;
+  typedef TmidData::serialised_type serialised_type;
+
+  TmidDataView(Name name, const serialised_type& serialised_tmid);
+
+  Name name() const { return name_; }
+  boost::string_ref encrypted_session() const { return encrypted_session_; }
+  boost::string_ref validation_token() const { return validation_token_; }
+
+ private:
+  TmidDataView();
+  TmidDataView(Name name, serialised_type&& serialised_tmid);
+  Name name_;
+  boost::string_ref encrypted_session_;
+  boost::string_ref validation_token_;
+};
 
+// Returns true if 'tmid' is named by the hash of its encrypted session and that session is signed
+// by 'public_antmid'.  The session, which may be large, is hashed only once for both checks.
+bool ValidateTmid(const TmidData& tmid, const PublicFob<AntmidTag>& public_antmid);
+
+// Batch checks of packets against their signers' public keys, where 'public_keys[i]' is that of
+// the signer of 'packets[i]'.  Returns one result per packet, in order; a Tmid is checked as by
+// ValidateTmid, a Mid or Smid only for its validation token.  Packets are checked in parallel, and
+// all packets whose public keys have the same name share a single verifier, so each distinct key
+// is decoded and prepared only once per batch.  An invalid public key fails its packets rather
+// than the batch.  Throws CommonErrors::invalid_parameter if the vectors' sizes differ.
+std::vector<bool> ValidatePackets(const std::vector<MidData<MidTag>>& packets,
+                                  const std::vector<PublicFob<AnmidTag>>& public_keys);
+std::vector<bool> ValidatePackets(const std::vector<MidData<SmidTag>>& packets,
+                                  const std::vector<PublicFob<AnsmidTag>>& public_keys);
+std::vector<bool> ValidatePackets(const std::vector<TmidData>& packets,
+                                  const std::vector<PublicFob<AntmidTag>>& public_keys);
+
+
+// The encryption functions use 'kdf_policy', which defaults to the original KdfPolicy::kPinScaled.
+// Decryption uses whichever policy the data was encrypted under.  Sessions are encrypted and
+// authenticated in a single AES-GCM pass, except under KdfPolicy::kPinScaled which writes the
+// original unauthenticated format.  All formats remain decryptable, and decrypting an
+// authenticated session with the wrong credentials, or one which has been modified, throws
+// CommonErrors::symmetric_encryption_error.
 EncryptedSession EncryptSession(const Keyword& keyword,
                                 const Pin& pin,
                                 const Password& password,
-                                const NonEmptyString& serialised_session);
+                                const NonEmptyString& serialised_session,
+                                const KdfPolicy& kdf_policy = KdfPolicy::PinScaled());
 
 NonEmptyString DecryptSession(const Keyword& keyword,
                               const Pin& pin,
@@ -187,12 +321,97 @@ NonEmptyString DecryptSession(const Keyword& keyword,
 // TMID name is now what used to be RID (Random ID)
 EncryptedTmidName EncryptTmidName(const Keyword& keyword,
                                   const Pin& pin,
-                                  const TmidData::Name& tmid_name);
+                                  const TmidData::Name& tmid_name,
+                                  const KdfPolicy& kdf_policy = KdfPolicy::PinScaled());
 
 TmidData::Name DecryptTmidName(const Keyword& keyword,
                                const Pin& pin,
                                const EncryptedTmidName& encrypted_tmid_name);
 
+// Streaming equivalents of EncryptSession and DecryptSession for large sessions, reading 'source'
+// and writing 'sink' a chunk at a time so that memory use doesn't grow with the session's size.
+// The encrypted form is identical to that of the non-streaming functions, so either may be used to
+// decrypt the output of the other.  Encryption in the authenticated format needs the session's
+// size up front, and reads the session twice to synthesise the AES-GCM nonce, so its 'source' must
+// then be seekable.  Decryption authenticates the session only once the whole of it has been
+// written to 'sink', so if this throws, whatever was written must be discarded.
+void EncryptSession(const Keyword& keyword,
+                    const Pin& pin,
+                    const Password& password,
+                    std::istream& source,
+                    std::ostream& sink,
+                    const KdfPolicy& kdf_policy = KdfPolicy::PinScaled());
+
+void DecryptSession(const Keyword& keyword,
+                    const Pin& pin,
+                    const Password& password,
+                    std::istream& source,
+                    std::ostream& sink);
+
+// Returns the policy under which the data was encrypted.
+KdfPolicy GetKdfPolicy(const EncryptedSession& encrypted_session);
+KdfPolicy GetKdfPolicy(const EncryptedTmidName& encrypted_tmid_name);
+
+// Holds the keyword, pin and password material for a single login, so that the identity_data
+// operations above don't each decrypt the user's input, rehash it and rerun the PBKDF2 derivations.
+// The inputs are decrypted and hashed once on construction; each PBKDF2-derived key is computed on
+// first use and then reused.  All of this is held in locked memory and wiped on destruction.  The
+// results are identical to those of the free functions given the same KdfPolicy, and a const
+// instance may be used concurrently from several threads.
+class LoginContext {
+ public:
+  // Without a password, only the Mid/Smid names and Tmid name encryption are available.  Keys are
+  // cached for 'kdf_policy', which is also used for encryption.  Decrypting data written under a
+  // different policy derives the keys it needs without caching them.
+  LoginContext(const Keyword& keyword, const Pin& pin,
+               const KdfPolicy& kdf_policy = KdfPolicy::PinScaled());
+  LoginContext(const Keyword& keyword, const Pin& pin, const Password& password,
+               const KdfPolicy& kdf_policy = KdfPolicy::PinScaled());
+
+  MidData<MidTag>::Name MidName() const;
+  MidData<SmidTag>::Name SmidName() const;
+
+  EncryptedTmidName EncryptTmidName(const TmidData::Name& tmid_name) const;
+  TmidData::Name DecryptTmidName(const EncryptedTmidName& encrypted_tmid_name) const;
+
+  // These throw CommonErrors::uninitialised if the context was constructed without a password.
+  // Decryption undoes whatever compression the session was encrypted with.
+  EncryptedSession EncryptSession(
+      const NonEmptyString& serialised_session,
+      SessionCompression compression = SessionCompression::kNone) const;
+  NonEmptyString DecryptSession(const EncryptedSession& encrypted_session) const;
+  void EncryptSession(std::istream& source,
+                      std::ostream& sink,
+                      SessionCompression compression = SessionCompression::kNone) const;
+  void DecryptSession(std::istream& source, std::ostream& sink) const;
+
+  // Derives every key needed for data written under this context's policy up front.  The
+  // derivations are independent, so they run concurrently and the cost is that of the slowest
+  // rather than the sum of all of them.  Subsequent calls to the methods above then do no PBKDF2
+  // work for such data.
+  void DeriveKeys() const;
+
+ private:
+  LoginContext(const LoginContext&);
+  LoginContext& operator=(const LoginContext&);
+
+  const SafeString& SecureMidPassword() const;
+  const SafeString& SecureTmidPassword() const;
+  const SafeString& ObfuscationKey() const;
+  void DeriveSessionKeys() const;
+  SafeString SecureMidPassword(const KdfPolicy& kdf_policy) const;
+  SafeString SecureTmidPassword(const KdfPolicy& kdf_policy) const;
+  std::pair<SafeString, SafeString> SessionKeys(const KdfPolicy& kdf_policy) const;
+
+  SafeString keyword_, pin_, password_;
+  uint32_t pin_value_;
+  KdfPolicy kdf_policy_;
+  SecureString::Hash pin_hash_, mid_name_hash_;
+  mutable SafeString secure_mid_password_, secure_tmid_password_, obfuscation_key_;
+  mutable std::once_flag secure_mid_password_flag_, secure_tmid_password_flag_,
+                         obfuscation_key_flag_, session_keys_flag_;
+};
+
 }  // namespace detail
 }  // namespace passport
 }  // namespace maidsafe
@@ -19,13 +19,16 @@
 #ifndef MAIDSAFE_PASSPORT_DETAIL_PUBLIC_FOB_H_
 #define MAIDSAFE_PASSPORT_DETAIL_PUBLIC_FOB_H_
 
+#include <memory>
 #include <type_traits>
 
+#include "maidsafe/common/crypto.h"
 #include "maidsafe/common/rsa.h"
 #include "maidsafe/common/types.h"
 
 #include "maidsafe/passport/detail/config.h"
 #include "maidsafe/passport/detail/fob.h"
+#include "maidsafe/passport/detail/signature_scheme.h"
 
 
 namespace maidsafe {
@@ -34,13 +37,19 @@ namespace detail {
 
 void PublicFobFromProtobuf(const NonEmptyString& serialised_public_fob,
                            DataTagValue enum_value,
-                           asymm::PublicKey& public_key,
+                           RsaScheme::PublicKey& public_key,
+                           asymm::Signature& validation_token);
+void PublicFobFromProtobuf(const NonEmptyString& serialised_public_fob,
+                           DataTagValue enum_value,
+                           EcdsaScheme::PublicKey& public_key,
                            asymm::Signature& validation_token);
 
 NonEmptyString PublicFobToProtobuf(DataTagValue enum_value,
-                                   const asymm::PublicKey& public_key,
+                                   const RsaScheme::PublicKey& public_key,
+                                   const asymm::Signature& validation_token);
+NonEmptyString PublicFobToProtobuf(DataTagValue enum_value,
+                                   const EcdsaScheme::PublicKey& public_key,
                                    const asymm::Signature& validation_token);
-
 
 template<typename TagType>
 class PublicFob {
@@ -48,6 +57,7 @@ class PublicFob {
   typedef maidsafe::detail::Name<PublicFob> Name;
   typedef TagType Tag;
   typedef typename Signer<Tag>::type signer_type;
+  typedef typename SignatureScheme<Tag>::type scheme_type;
   typedef TaggedValue<NonEmptyString, Tag> serialised_type;
 
   PublicFob(const PublicFob& other);
@@ -60,27 +70,40 @@ class PublicFob {
   serialised_type Serialise() const;
 
   Name name() const { return name_; }
-  asymm::PublicKey public_key() const { return public_key_; }
+  typename scheme_type::PublicKey public_key() const { return public_key_; }
   asymm::Signature validation_token() const { return validation_token_; }
 
+  // Checks a signature made by the corresponding Fob's private key, reusing the verifier built for
+  // this key by any previous call on this PublicFob or any of its copies.
+  bool Verify(const asymm::PlainText& data, const asymm::Signature& signature) const;
+  // Also sets 'digest' to the SHA-512 hash of 'data', taken from the verification's own hashing
+  // pass, so that callers checking a name derived from 'data' needn't hash it again.
+  bool Verify(const asymm::PlainText& data,
+              const asymm::Signature& signature,
+              crypto::SHA512Hash& digest) const;
+  void PrecomputeVerifier() const { verifier_->Precompute(public_key_); }
+
  private:
   PublicFob();
   Name name_;
-  asymm::PublicKey public_key_;
+  typename scheme_type::PublicKey public_key_;
   asymm::Signature validation_token_;
+  std::shared_ptr<CachedVerifier<scheme_type>> verifier_;
 };
 
 template<typename Tag>
 PublicFob<Tag>::PublicFob(const PublicFob<Tag>& other)
     : name_(other.name_),
       public_key_(other.public_key_),
-      validation_token_(other.validation_token_) {}
+      validation_token_(other.validation_token_),
+      verifier_(other.verifier_) {}
 
 template<typename Tag>
 PublicFob<Tag>& PublicFob<Tag>::operator=(const PublicFob<Tag>& other) {
   name_ = other.name_;
   public_key_ = other.public_key_;
   validation_token_ = other.validation_token_;
+  verifier_ = other.verifier_;
   return *this;
 }
 
@@ -88,13 +111,15 @@ template<typename Tag>
 PublicFob<Tag>::PublicFob(PublicFob<Tag>&& other)
     : name_(std::move(other.name_)),
       public_key_(std::move(other.public_key_)),
-      validation_token_(std::move(other.validation_token_)) {}
+      validation_token_(std::move(other.validation_token_)),
+      verifier_(other.verifier_) {}
 
 template<typename Tag>
 PublicFob<Tag>& PublicFob<Tag>::operator=(PublicFob<Tag>&& other) {
   name_ = std::move(other.name_);
   public_key_ = std::move(other.public_key_);
   validation_token_ = std::move(other.validation_token_);
+  verifier_ = other.verifier_;
   return *this;
 }
 
@@ -102,7 +127,8 @@ template<typename Tag>
 PublicFob<Tag>::PublicFob(const Fob<Tag>& fob)
     : name_(fob.name()),
       public_key_(fob.public_key()),
-      validation_token_(fob.validation_token()) {}
+      validation_token_(fob.validation_token()),
+      verifier_(std::make_shared<CachedVerifier<scheme_type>>()) {}
 
 // TODO(Fraser#5#): 2012-12-21 - Once MSVC eventually handles delegating constructors, we can make
 //                  this more efficient by using a lambda which returns the parsed protobuf
@@ -110,7 +136,10 @@ PublicFob<Tag>::PublicFob(const Fob<Tag>& fob)
 template <typename TagType>
 PublicFob<TagType>::PublicFob(Name name,
                               const serialised_type& serialised_public_fob)
-    : name_(std::move(name)), public_key_(), validation_token_() {
+    : name_(std::move(name)),
+      public_key_(),
+      validation_token_(),
+      verifier_(std::make_shared<CachedVerifier<scheme_type>>()) {
   if (!name_->IsInitialised())
     ThrowError(PassportErrors::fob_parsing_error);
   PublicFobFromProtobuf(serialised_public_fob.data, Tag::kValue, public_key_, validation_token_);
@@ -121,6 +150,19 @@ typename PublicFob<Tag>::serialised_type PublicFob<Tag>::Serialise() const {
   return serialised_type(PublicFobToProtobuf(Tag::kValue, public_key_, validation_token_));
 }
 
+template<typename Tag>
+bool PublicFob<Tag>::Verify(const asymm::PlainText& data,
+                            const asymm::Signature& signature) const {
+  return verifier_->Verify(public_key_, data, signature);
+}
+
+template<typename Tag>
+bool PublicFob<Tag>::Verify(const asymm::PlainText& data,
+                            const asymm::Signature& signature,
+                            crypto::SHA512Hash& digest) const {
+  return verifier_->Verify(public_key_, data, signature, digest);
+}
+
 }  // namespace detail
 }  // namespace passport
 }  // namespace maidsafe
@@ -29,94 +29,224 @@
 #else
 # include <unistd.h>  // for sysconf
 # include <sys/mman.h>
+# include <sys/resource.h>  // for getrlimit
 # include <climits>  // for PAGESIZE
 #endif
 
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <new>
 #include <string>
 #include <memory>
-#include <map>
 #include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 
 namespace maidsafe {
 namespace passport {
 namespace detail {
 
+// Snapshot of locked memory usage, for diagnostics.  Counts of calls, failures and waiting time are
+// totals since the process started.  If lock calls fail, typically because the locked memory limit
+// has been reached, the affected pages may be swapped out.
+struct LockedMemoryStats {
+  LockedMemoryStats()
+      : locked_pages(0),
+        peak_locked_pages(0),
+        failed_pages(0),
+        page_size(0),
+        requested_bytes(0),
+        lock_calls(0),
+        lock_failures(0),
+        unlock_calls(0),
+        unlock_failures(0),
+        mutex_wait_nanoseconds(0),
+        arena_regions(0),
+        arena_locked_bytes(0),
+        arena_lock_failures(0),
+        locked_bytes_limit(0) {}
+  // LockedPageManager: pages currently locked and the most ever locked at once, pages currently in
+  // use whose lock failed (and so may be swapped out), the total size of the ranges currently
+  // requesting locks, the lock and unlock calls made to the OS, and the time spent waiting for its
+  // mutexes.
+  uint64_t locked_pages, peak_locked_pages, failed_pages, page_size, requested_bytes;
+  uint64_t lock_calls, lock_failures, unlock_calls, unlock_failures;
+  uint64_t mutex_wait_nanoseconds;
+  // SecureArena: reserved regions, their total size, and how many of them couldn't be locked.
+  uint64_t arena_regions, arena_locked_bytes, arena_lock_failures;
+  // The process's locked memory limit (RLIMIT_MEMLOCK), or the maximum uint64_t value if it's
+  // unlimited or unknown.
+  uint64_t locked_bytes_limit;
+};
+
 // Thread-safe class to keep track of locked (ie, non-swappable) memory pages.
 // Memory locks do not stack, that is, pages which have been locked several times by calls to
 // mlock() will be unlocked by a single call to munlock(). This can result in keying material
 // ending up in swap when those functions are used naively. This class simulates stacking memory
 // locks by keeping a counter per page.
-// NOTE: By using a map from each page base address to lock count, this class is optimized for small
-// objects that span up to a few pages, mostly smaller than a page. To support large allocations,
-// something like an interval tree would be the preferred data structure.
+// The counters are split across a fixed number of shards, each a hash table behind its own mutex,
+// with consecutive pages mapped to consecutive shards.  Range operations therefore cost one hash
+// lookup per page touched, and threads working on different pages rarely contend.  A page's
+// counter and its lock state are only changed while its shard is locked, so a page is never
+// unlocked while its count is non-zero.
 template<typename Locker>
 class LockedPageManagerBase {
  public:
   explicit LockedPageManagerBase(size_t page_size)
       : locker_(),
-        mutex_(),
         page_size_(page_size),
         page_mask_(~(page_size - 1)),  // bitmask for extracting page from address
-        histogram_() {
+        shards_(),
+        locked_pages_(0),
+        peak_locked_pages_(0),
+        failed_pages_(0),
+        requested_bytes_(0),
+        lock_calls_(0),
+        lock_failures_(0),
+        unlock_calls_(0),
+        unlock_failures_(0),
+        mutex_wait_nanoseconds_(0) {
     assert(!(page_size & (page_size-1)));  // size must be power of two
   }
 
   // For all pages in affected range, increase lock count
   void LockRange(void* p, size_t size) {
-    std::lock_guard<std::mutex> lock(mutex_);
     if (!size)
       return;
     const size_t base_address = reinterpret_cast<size_t>(p);
     const size_t start_page = base_address & page_mask_;
     const size_t end_page = (base_address + size - 1) & page_mask_;
     for (size_t page = start_page; page <= end_page; page += page_size_) {
-      Histogram::iterator it = histogram_.find(page);
-      if (it == histogram_.end()) {  // Newly locked page
-        locker_.Lock(reinterpret_cast<void*>(page), page_size_);
-        histogram_.insert(std::make_pair(page, 1));
-      } else {  // Page was already locked; increase counter
-        it->second += 1;
+      Shard& shard(GetShard(page));
+      std::lock_guard<std::mutex> lock(shard.mutex, LockShard(shard));
+      PageLock& page_lock(shard.histogram[page]);
+      if (++page_lock.count == 1) {  // Newly locked page
+        ++lock_calls_;
+        page_lock.locked = locker_.Lock(reinterpret_cast<void*>(page), page_size_);
+        if (page_lock.locked) {
+          UpdatePeak(++locked_pages_);
+        } else {
+          ++lock_failures_;
+          ++failed_pages_;
+        }
       }
     }
+    requested_bytes_ += size;
   }
 
   // For all pages in affected range, decrease lock count
   void UnlockRange(void* p, size_t size) {
-    std::lock_guard<std::mutex> lock(mutex_);
     if (!size)
       return;
     const size_t base_address = reinterpret_cast<size_t>(p);
     const size_t start_page = base_address & page_mask_;
     const size_t end_page = (base_address + size - 1) & page_mask_;
     for (size_t page = start_page; page <= end_page; page += page_size_) {
-      Histogram::iterator it = histogram_.find(page);
-      assert(it != histogram_.end());  // Cannot unlock an area that was not locked
+      Shard& shard(GetShard(page));
+      std::lock_guard<std::mutex> lock(shard.mutex, LockShard(shard));
+      typename Histogram::iterator it = shard.histogram.find(page);
+      assert(it != shard.histogram.end());  // Cannot unlock an area that was not locked
       // Decrease counter for page, when it is zero, the page will be unlocked
-      it->second -= 1;
-      if (it->second == 0) {  // Nothing on the page anymore that keeps it locked
-        // Unlock page and remove the count from histogram_
-        locker_.Unlock(reinterpret_cast<void*>(page), page_size_);
-        histogram_.erase(it);
+      it->second.count -= 1;
+      if (it->second.count == 0) {  // Nothing on the page anymore that keeps it locked
+        // Unlock page, unless locking it failed, and remove the count from histogram
+        if (it->second.locked) {
+          ++unlock_calls_;
+          if (!locker_.Unlock(reinterpret_cast<void*>(page), page_size_))
+            ++unlock_failures_;
+          --locked_pages_;
+        } else {
+          --failed_pages_;
+        }
+        shard.histogram.erase(it);
       }
     }
+    requested_bytes_ -= size;
   }
 
   // Get number of locked pages for diagnostics
   int GetLockedPageCount() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return histogram_.size();
+    size_t count(0);
+    for (const Shard& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      count += shard.histogram.size();
+    }
+    return static_cast<int>(count);
+  }
+
+  // Sets the LockedPageManager fields of 'stats'.  The values are read without blocking other
+  // threads, so they needn't be mutually consistent while ranges are being locked or unlocked.
+  void GetStats(LockedMemoryStats& stats) const {
+    stats.locked_pages = locked_pages_;
+    stats.peak_locked_pages = peak_locked_pages_;
+    stats.failed_pages = failed_pages_;
+    stats.page_size = page_size_;
+    stats.requested_bytes = requested_bytes_;
+    stats.lock_calls = lock_calls_;
+    stats.lock_failures = lock_failures_;
+    stats.unlock_calls = unlock_calls_;
+    stats.unlock_failures = unlock_failures_;
+    stats.mutex_wait_nanoseconds = mutex_wait_nanoseconds_;
   }
 
  private:
+  LockedPageManagerBase(const LockedPageManagerBase&);
+  LockedPageManagerBase& operator=(const LockedPageManagerBase&);
+
+  static const size_t kShardCount = 64;  // must be a power of two
+  struct PageLock {
+    PageLock() : count(0), locked(false) {}
+    int count;
+    bool locked;  // whether the call to lock the page succeeded
+  };
   // map of page base address to lock count
-  typedef std::map<size_t, int> Histogram;
+  typedef std::unordered_map<size_t, PageLock> Histogram;
+  // Aligned to a typical cache line so that neighbouring shards' mutexes don't share one.
+  struct alignas(64) Shard {
+    Shard() : mutex(), histogram() {}
+    mutable std::mutex mutex;
+    Histogram histogram;
+  };
+
+  Shard& GetShard(size_t page) {
+    return shards_[(page / page_size_) & (kShardCount - 1)];
+  }
+
+  // Locks the shard's mutex, timing the wait only if it's contended.  Returns the tag for adopting
+  // the lock in a std::lock_guard.
+  std::adopt_lock_t LockShard(Shard& shard) {
+    if (!shard.mutex.try_lock()) {
+      const auto start(std::chrono::steady_clock::now());
+      shard.mutex.lock();
+      mutex_wait_nanoseconds_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start).count();
+    }
+    return std::adopt_lock;
+  }
+
+  void UpdatePeak(uint64_t locked_pages) {
+    uint64_t peak(peak_locked_pages_);
+    while (locked_pages > peak && !peak_locked_pages_.compare_exchange_weak(peak, locked_pages)) {}
+  }
+
   Locker locker_;
-  mutable std::mutex mutex_;
-  size_t page_size_, page_mask_;
-  Histogram histogram_;
+  const size_t page_size_, page_mask_;
+  std::array<Shard, kShardCount> shards_;
+  std::atomic<uint64_t> locked_pages_, peak_locked_pages_, failed_pages_, requested_bytes_;
+  std::atomic<uint64_t> lock_calls_, lock_failures_, unlock_calls_, unlock_failures_;
+  std::atomic<uint64_t> mutex_wait_nanoseconds_;
 };
 
+template<typename Locker> const size_t LockedPageManagerBase<Locker>::kShardCount;
+
 // Determine system page size in bytes
 static inline size_t GetSystemPageSize() {
   size_t page_size;
@@ -132,6 +262,48 @@ static inline size_t GetSystemPageSize() {
   return page_size;
 }
 
+// Zeroes 'size' bytes at 'ptr' as fast as memset does, in a way the compiler can't elide even when
+// the memory is about to be freed.
+static inline void SecureWipe(void* ptr, size_t size) {
+  if (!size)
+    return;
+#if defined(MAIDSAFE_WIN32)
+  SecureZeroMemory(ptr, size);
+#elif defined(__GNUC__) || defined(__clang__)
+  std::memset(ptr, 0, size);
+  // Tells the compiler the zeroed memory may be read, so the memset isn't a dead store.
+  __asm__ __volatile__("" : : "r"(ptr) : "memory");
+#else
+  static void* (*const volatile memset_function)(void*, int, size_t) = std::memset;
+  memset_function(ptr, 0, size);
+#endif
+}
+
+// Reserve and release whole pages directly from the OS.  'size' must be a multiple of the system
+// page size.  AllocatePages returns nullptr on failure.
+static inline void* AllocatePages(size_t size) {
+#if defined(MAIDSAFE_WIN32)
+  return VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+  void* address(mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0));
+  if (address == MAP_FAILED)
+    return nullptr;
+#  ifdef MADV_DONTDUMP
+  madvise(address, size, MADV_DONTDUMP);  // keep secrets out of core dumps
+#  endif
+  return address;
+#endif
+}
+
+static inline void FreePages(void* address, size_t size) {
+#if defined(MAIDSAFE_WIN32)
+  static_cast<void>(size);
+  VirtualFree(address, 0, MEM_RELEASE);
+#else
+  munmap(address, size);
+#endif
+}
+
 // OS-dependent memory page locking/unlocking.
 // Defined as policy class to make stubbing for test possible.
 class MemoryPageLocker {
@@ -163,8 +335,196 @@ class LockedPageManager : public LockedPageManagerBase<MemoryPageLocker> {
   LockedPageManager() : LockedPageManagerBase<MemoryPageLocker>(GetSystemPageSize()) {}
 };
 
+// Thread-safe pool of locked memory for small allocations.  Regions of whole pages are reserved and
+// locked once, then carved into chunks of a few power-of-two size classes which are recycled via
+// per-class free lists.  Compared with locking arbitrary heap pages per allocation, this avoids a
+// lock syscall and page-table update for most allocations, keeps secrets on pages which hold
+// nothing else, and limits the amount of locked memory to a whole number of regions.
+// Regions are only released when the arena is destroyed.
+template<typename Locker>
+class SecureArenaBase {
+ public:
+  // Largest allocation served by the arena, and the alignment of every chunk it returns.
+  static const size_t kMaxChunkSize = 2048;
+  static const size_t kChunkAlignment = 16;
+
+  SecureArenaBase(size_t page_size, size_t region_size)
+      : locker_(),
+        mutex_(),
+        region_size_(((region_size + page_size - 1) / page_size) * page_size),
+        regions_(),
+        next_chunk_(nullptr),
+        region_end_(nullptr),
+        free_lists_(),
+        lock_failures_(0) {
+    assert(!(page_size & (page_size - 1)));  // size must be power of two
+    assert(region_size_ >= kMaxChunkSize);
+  }
+
+  ~SecureArenaBase() {
+    for (char* region : regions_) {
+      SecureWipe(region, region_size_);
+      locker_.Unlock(region, region_size_);
+      FreePages(region, region_size_);
+    }
+  }
+
+  // 'size' must not exceed kMaxChunkSize.  Throws std::bad_alloc if a new region is required and
+  // can't be reserved.
+  void* Allocate(size_t size) {
+    assert(size <= kMaxChunkSize);
+    const size_t size_class(SizeClass(size));
+    std::lock_guard<std::mutex> lock(mutex_);
+    FreeChunk*& head(free_lists_[size_class]);
+    if (head) {
+      FreeChunk* chunk(head);
+      head = chunk->next;
+      return chunk;
+    }
+    const size_t chunk_size(kChunkAlignment << size_class);
+    if (static_cast<size_t>(region_end_ - next_chunk_) < chunk_size)
+      ReserveRegion();
+    void* chunk(next_chunk_);
+    next_chunk_ += chunk_size;
+    return chunk;
+  }
+
+  // 'size' must be the value passed to the Allocate call which returned 'ptr'.  The chunk's
+  // contents should already have been cleared by the caller.
+  void Deallocate(void* ptr, size_t size) {
+    if (!ptr)
+      return;
+    assert(size <= kMaxChunkSize);
+    const size_t size_class(SizeClass(size));
+    std::lock_guard<std::mutex> lock(mutex_);
+    PushFreeChunk(ptr, size_class);
+  }
+
+  // Get number of reserved regions for diagnostics
+  size_t GetRegionCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return regions_.size();
+  }
+
+  size_t region_size() const { return region_size_; }
+
+  // Sets the SecureArena fields of 'stats'.
+  void GetStats(LockedMemoryStats& stats) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats.arena_regions = regions_.size();
+    stats.arena_locked_bytes = (regions_.size() - lock_failures_) * region_size_;
+    stats.arena_lock_failures = lock_failures_;
+  }
+
+ protected:
+  static const size_t kSizeClassCount = 8;  // 16, 32, ..., 2048 bytes
+  struct FreeChunk {
+    FreeChunk* next;
+  };
+
+  static size_t SizeClass(size_t size) {
+    size_t size_class(0);
+    while ((kChunkAlignment << size_class) < size)
+      ++size_class;
+    return size_class;
+  }
+
+ private:
+  SecureArenaBase(const SecureArenaBase&);
+  SecureArenaBase& operator=(const SecureArenaBase&);
+
+  void PushFreeChunk(void* ptr, size_t size_class) {
+    FreeChunk* chunk(static_cast<FreeChunk*>(ptr));
+    chunk->next = free_lists_[size_class];
+    free_lists_[size_class] = chunk;
+  }
+
+  // Hands the unused tail of the current region to the free lists, then reserves a new region.
+  // Must be called with mutex_ locked.
+  void ReserveRegion() {
+    size_t remaining(static_cast<size_t>(region_end_ - next_chunk_));
+    size_t size_class(kSizeClassCount);
+    while (remaining >= kChunkAlignment) {
+      while ((kChunkAlignment << --size_class) > remaining) {}
+      PushFreeChunk(next_chunk_, size_class);
+      next_chunk_ += kChunkAlignment << size_class;
+      remaining -= kChunkAlignment << size_class;
+      size_class = kSizeClassCount;
+    }
+    char* base(static_cast<char*>(AllocatePages(region_size_)));
+    if (!base)
+      throw std::bad_alloc();
+    if (!locker_.Lock(base, region_size_))
+      ++lock_failures_;
+    regions_.push_back(base);
+    next_chunk_ = base;
+    region_end_ = base + region_size_;
+  }
+
+  Locker locker_;
+  mutable std::mutex mutex_;
+  const size_t region_size_;
+  std::vector<char*> regions_;  // base address of each region
+  char* next_chunk_;
+  char* region_end_;
+  std::array<FreeChunk*, kSizeClassCount> free_lists_;
+  size_t lock_failures_;
+};
+
+template<typename Locker> const size_t SecureArenaBase<Locker>::kMaxChunkSize;
+template<typename Locker> const size_t SecureArenaBase<Locker>::kChunkAlignment;
+template<typename Locker> const size_t SecureArenaBase<Locker>::kSizeClassCount;
+
+// Singleton arena serving the small allocations of safe_allocator.  It's never destroyed, since
+// objects with static storage duration may release memory to it during program exit.
+// Each thread keeps a small cache of freed chunks per size class, so that short-lived allocations
+// are recycled without taking the arena's mutex.  A thread's cache is returned to the arena when
+// the thread exits.
+class SecureArena : public SecureArenaBase<MemoryPageLocker> {
+ public:
+  static const size_t kDefaultThreadCacheLimit = 16;
+
+  static SecureArena& Instance() {
+    static SecureArena* const arena(new SecureArena);
+    return *arena;
+  }
+
+  void* Allocate(size_t size);
+  void Deallocate(void* ptr, size_t size);
+  // Sets the maximum number of chunks of each size class held by each thread's cache.  Zero
+  // disables caching.  A cache already holding more than a lowered limit drains as its thread
+  // allocates.
+  void SetThreadCacheLimit(size_t limit) { thread_cache_limit_ = limit; }
+  size_t thread_cache_limit() const { return thread_cache_limit_; }
+
+ private:
+  class ThreadCache;
+
+  SecureArena()
+      : SecureArenaBase<MemoryPageLocker>(GetSystemPageSize(), 64 * 1024),
+        thread_cache_limit_(kDefaultThreadCacheLimit) {}
+  ThreadCache* GetThreadCache();
+
+  std::atomic<size_t> thread_cache_limit_;
+};
+
+// Returns the current usage of locked memory by LockedPageManager and SecureArena.
+inline LockedMemoryStats GetLockedMemoryStats() {
+  LockedMemoryStats stats;
+  LockedPageManager::instance.GetStats(stats);
+  SecureArena::Instance().GetStats(stats);
+  stats.locked_bytes_limit = std::numeric_limits<uint64_t>::max();
+#ifndef MAIDSAFE_WIN32
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    stats.locked_bytes_limit = limit.rlim_cur;
+#endif
+  return stats;
+}
+
 // Allocator that locks its contents from being paged out of memory and clears its contents before
-// deletion.
+// deletion.  Allocations of up to SecureArena::kMaxChunkSize bytes are served from SecureArena;
+// larger ones come from the heap and have their pages locked individually.
 template<typename T>
 struct safe_allocator : public std::allocator<T> {
   typedef std::allocator<T> base;
@@ -188,6 +548,8 @@ struct safe_allocator : public std::allocator<T> {
   };
 
   pointer allocate(size_type count, const void* hint = 0) {
+    if (UseArena(count))
+      return static_cast<pointer>(SecureArena::Instance().Allocate(sizeof(value_type) * count));
     pointer ptr;
     ptr = std::allocator<value_type>::allocate(count, hint);
     if (ptr)
@@ -197,17 +559,21 @@ struct safe_allocator : public std::allocator<T> {
 
   void deallocate(pointer ptr, size_type count) {
     if (ptr) {
-      size_type size(sizeof(value_type) * count);
-      volatile char* vptr = reinterpret_cast<volatile char*>(ptr);
-      while (size) {
-        *vptr = 0;
-        vptr++;
-        size--;
+      SecureWipe(ptr, sizeof(value_type) * count);
+      if (UseArena(count)) {
+        SecureArena::Instance().Deallocate(ptr, sizeof(value_type) * count);
+        return;
       }
       LockedPageManager::instance.UnlockRange(ptr, sizeof(value_type) * count);
     }
     std::allocator<value_type>::deallocate(ptr, count);
   }
+
+ private:
+  static bool UseArena(size_type count) {
+    return std::alignment_of<value_type>::value <= SecureArena::kChunkAlignment &&
+           count <= SecureArena::kMaxChunkSize / sizeof(value_type);
+  }
 };
 
 // Allocator that clears its contents before deletion.
@@ -234,15 +600,8 @@ struct zero_after_free_allocator : public std::allocator<T> {
   };
 
   void deallocate(pointer ptr, size_type count) {
-    if (ptr) {
-      size_type size(sizeof(value_type) * count);
-      volatile char* vptr = reinterpret_cast<volatile char*>(ptr);
-      while (size) {
-        *vptr = 0;
-        vptr++;
-        size--;
-      }
-    }
+    if (ptr)
+      SecureWipe(ptr, sizeof(value_type) * count);
     std::allocator<value_type>::deallocate(ptr, count);
   }
 };
@@ -19,18 +19,25 @@
 #ifndef MAIDSAFE_PASSPORT_DETAIL_SECURE_STRING_H_
 #define MAIDSAFE_PASSPORT_DETAIL_SECURE_STRING_H_
 
+#include <array>
+#include <cstdint>
 #include <string>
-#include <map>
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <typeindex>
+#include <typeinfo>
+#include <vector>
 
 #include "boost/regex.hpp"
 
 #ifdef __MSVC__
 #  pragma warning(push, 1)
 #endif
+#include "cryptopp/aes.h"
 #include "cryptopp/filters.h"
 #include "cryptopp/default.h"
-#include "cryptopp/hex.h"
 #include "cryptopp/secblock.h"
 #ifdef __MSVC__
 #  pragma warning(pop)
@@ -53,8 +60,6 @@ class SecureString {
  public:
   typedef CryptoPP::DefaultEncryptor Encryptor;
   typedef CryptoPP::DefaultDecryptor Decryptor;
-  typedef CryptoPP::HexEncoder Encoder;
-  typedef CryptoPP::HexDecoder Decoder;
   typedef CryptoPP::StringSinkTemplate<SafeString> Sink;
   typedef maidsafe::detail::BoundedString<SHA512::DIGESTSIZE, SHA512::DIGESTSIZE, SafeString> Hash;
   typedef SafeString::size_type size_type;
@@ -80,7 +85,7 @@ template<typename StringType>
 SecureString::SecureString(const StringType& string)
   : phrase_(RandomSafeString<SafeString>(64)),
     string_(),
-    encryptor_(new Encryptor(phrase_.data(), new Encoder(new Sink(string_)))) {
+    encryptor_(new Encryptor(phrase_.data(), new Sink(string_))) {
   encryptor_->Put(reinterpret_cast<const byte*>(string.data()), string.size());
   encryptor_->MessageEnd();
 }
@@ -91,14 +96,91 @@ void SecureString::Append(const StringType& decrypted_chars) {
 }
 
 
+// The set of characters matched by a regex, for validating SecureInputStrings.  Each character of
+// an input is validated separately, so for any pattern the result depends only on the character's
+// value.  The pattern is therefore evaluated once for each of the 256 values and inputs are checked
+// against the resulting table, without running the regex or allocating per character.  The regex
+// is kept for the entries of a string being edited which were inserted as several characters at
+// once, since those are matched as a whole.
+class CharacterValidator {
+ public:
+  explicit CharacterValidator(const boost::regex& regex);
+  // Returns a copy of a validator built previously for the same pattern and flags, if any.
+  static CharacterValidator Cached(const boost::regex& regex);
+
+  bool IsValid(char character) const { return valid_[static_cast<unsigned char>(character)] != 0; }
+  // True if every character in 'characters' is valid.
+  bool IsValid(const char* characters, size_t size) const;
+  const boost::regex& regex() const { return regex_; }
+
+ private:
+  boost::regex regex_;
+  std::array<unsigned char, 256> valid_;
+};
+
+// Keyed stream cipher protecting the characters of a SecureInputString while it's being edited.  A
+// random AES-256 key is generated for each instance and expanded once, so each encryption costs one
+// AES block per 16 characters: the characters are XORed with a counter mode keystream under a nonce
+// unique to the instance, and the nonce is prepended to the result.  The expanded key is held in
+// locked memory, as it's sufficient to recover the key.
+class InputCipher {
+ public:
+  InputCipher();
+  SafeString Encrypt(const char* decrypted_chars, size_t size) const;
+  SafeString Decrypt(const SafeString& encrypted_chars) const;
+
+ private:
+  InputCipher(const InputCipher&);
+  InputCipher& operator=(const InputCipher&);
+  void ApplyKeystream(uint64_t nonce, const char* input, char* output, size_t size) const;
+
+  std::shared_ptr<CryptoPP::AES::Encryption> aes_;
+  mutable uint64_t next_nonce_;
+};
+
+// The encrypted entries of a SecureInputString being edited, indexed by position.  Entries are held
+// in a gap buffer in locked memory, so a run of edits at or near the same position costs O(1)
+// amortised rather than renumbering every following entry.  Positions may be filled out of order;
+// a position not yet filled holds an empty entry.
+class EncryptedCharBuffer {
+ public:
+  typedef SafeString::size_type size_type;
+
+  EncryptedCharBuffer();
+
+  // Fills 'position' if it's empty or past the end, otherwise inserts before the entry there.
+  void Insert(size_type position, SafeString encrypted_chars);
+  // Removes 'length' positions, the first of which must hold an entry, and closes up the following
+  // ones.  Throws CommonErrors::invalid_parameter if the range isn't valid.
+  void Remove(size_type position, size_type length);
+  void Clear();
+
+  // The number of positions, including empty ones, up to and including the last entry.
+  size_type size() const { return buffer_.size() - (gap_end_ - gap_begin_); }
+  size_type entry_count() const { return entry_count_; }
+  const SafeString& operator[](size_type position) const {
+    return buffer_[position < gap_begin_ ? position : position + (gap_end_ - gap_begin_)];
+  }
+
+ private:
+  typedef std::vector<SafeString, safe_allocator<SafeString>> Buffer;
+
+  EncryptedCharBuffer(const EncryptedCharBuffer&);
+  EncryptedCharBuffer& operator=(const EncryptedCharBuffer&);
+  SafeString& Slot(size_type position) {
+    return buffer_[position < gap_begin_ ? position : position + (gap_end_ - gap_begin_)];
+  }
+  void MoveGap(size_type position);
+  void ReserveGap(size_type gap_size);
+
+  Buffer buffer_;
+  size_type gap_begin_, gap_end_, entry_count_;
+};
+
+
 template<typename Predicate, SecureString::size_type Size>
 class SecureInputString {
  public:
-  typedef typename SecureString::Encryptor Encryptor;
-  typedef typename SecureString::Decryptor Decryptor;
-  typedef typename SecureString::Encoder Encoder;
-  typedef typename SecureString::Decoder Decoder;
-  typedef typename SecureString::Sink Sink;
   typedef typename SecureString::size_type size_type;
 
   SecureInputString();
@@ -113,7 +195,9 @@ class SecureInputString {
 
   bool IsInitialised() const;
   bool IsFinalised() const;
+  // Each character must match 'regex'.
   bool IsValid(const boost::regex& regex) const;
+  bool IsValid(const CharacterValidator& validator) const;
 
   template<typename HashType> SecureString::Hash Hash() const;
   size_type Value() const;
@@ -122,32 +206,44 @@ class SecureInputString {
 
  private:
   void Reset();
+  void ClearCache();
   template<typename StringType>
   SafeString Encrypt(const StringType& decrypted_chars) const;
   SafeString Encrypt(const char& decrypted_char) const;
   SafeString Decrypt(const SafeString& encrypted_char) const;
-  bool ValidateEncryptedChars(const boost::regex& regex) const;
-  bool ValidateSecureString(const boost::regex& regex) const;
+  bool ValidateEncryptedChars(const CharacterValidator& validator) const;
+  bool ValidateSecureString(const CharacterValidator& validator) const;
 
-  std::map<size_type, SafeString> encrypted_chars_;
-  SafeString phrase_;
+  EncryptedCharBuffer encrypted_chars_;
+  InputCipher cipher_;
   SecureString secure_string_;
   bool finalised_;
+  // Hashes and the numeric value of the finalised string, computed on first request and discarded
+  // whenever the string is modified.
+  mutable std::mutex cache_mutex_;
+  mutable std::map<std::type_index, SecureString::Hash> hashes_;
+  mutable std::vector<size_type, safe_allocator<size_type>> value_;
 };
 
 template<typename Predicate, SecureString::size_type Size>
 SecureInputString<Predicate, Size>::SecureInputString()
   : encrypted_chars_(),
-    phrase_(RandomSafeString<SafeString>(64)),
+    cipher_(),
     secure_string_(),
-    finalised_(false) {}
+    finalised_(false),
+    cache_mutex_(),
+    hashes_(),
+    value_() {}
 
 template<typename Predicate, SecureString::size_type Size> template<typename StringType>
 SecureInputString<Predicate, Size>::SecureInputString(const StringType& string)
   : encrypted_chars_(),
-    phrase_(RandomSafeString<SafeString>(64)),
+    cipher_(),
     secure_string_(string),
-    finalised_(true) {}
+    finalised_(true),
+    cache_mutex_(),
+    hashes_(),
+    value_() {}
 
 template<typename Predicate, SecureString::size_type Size>
 SecureInputString<Predicate, Size>::~SecureInputString() {}
@@ -157,20 +253,7 @@ void SecureInputString<Predicate, Size>::Insert(size_type position,
                                                 const StringType& decrypted_chars) {
   if (IsFinalised())
     Reset();
-  SafeString encrypted_chars(Encrypt(decrypted_chars));
-  auto it(encrypted_chars_.find(position));
-  if (it == encrypted_chars_.end()) {
-    encrypted_chars_.insert(std::make_pair(position, encrypted_chars));
-    return;
-  }
-  while (it != encrypted_chars_.end()) {
-    auto old_encrypted_chars = it->second;
-    it = encrypted_chars_.erase(it);
-    encrypted_chars_.insert(it, std::make_pair(position, encrypted_chars));
-    encrypted_chars = old_encrypted_chars;
-    position += 1;
-  }
-  encrypted_chars_.insert(std::make_pair(position, encrypted_chars));
+  encrypted_chars_.Insert(position, Encrypt(decrypted_chars));
   return;
 }
 
@@ -178,27 +261,15 @@ template<typename Predicate, SecureString::size_type Size>
 void SecureInputString<Predicate, Size>::Remove(size_type position, size_type length) {
   if (IsFinalised())
     Reset();
-  auto it(encrypted_chars_.find(position));
-  if (it == encrypted_chars_.end() || length == 0)
-    ThrowError(CommonErrors::invalid_parameter);
-  while (length != 0) {
-    it = encrypted_chars_.erase(it);
-    if ((length -= 1 != 0) && it == encrypted_chars_.end())
-      ThrowError(CommonErrors::invalid_parameter);
-  }
-  while (it != encrypted_chars_.end()) {
-    auto encrypted_char = it->second;
-    it = encrypted_chars_.erase(it);
-    encrypted_chars_.insert(it, std::make_pair(position, encrypted_char));
-    position += 1;
-  }
+  encrypted_chars_.Remove(position, length);
   return;
 }
 
 template<typename Predicate, SecureString::size_type Size>
 void SecureInputString<Predicate, Size>::Clear() {
-  encrypted_chars_.clear();
+  encrypted_chars_.Clear();
   secure_string_.Clear();
+  ClearCache();
   finalised_ = false;
   return;
 }
@@ -207,20 +278,18 @@ template<typename Predicate, SecureString::size_type Size>
 void SecureInputString<Predicate, Size>::Finalise() {
   if (IsFinalised())
     return;
-  if (!Predicate()(encrypted_chars_.size(), Size))
+  if (!Predicate()(encrypted_chars_.entry_count(), Size))
     ThrowError(CommonErrors::invalid_parameter);
-  uint32_t index(0);
-  for (auto& encrypted_char : encrypted_chars_) {
-    if (encrypted_char.first != index) {
+  for (size_type i(0); i != encrypted_chars_.size(); ++i) {
+    if (encrypted_chars_[i].empty()) {
       secure_string_.Clear();
       ThrowError(CommonErrors::invalid_parameter);
     }
-    SafeString decrypted_char(Decrypt(encrypted_char.second));
+    SafeString decrypted_char(Decrypt(encrypted_chars_[i]));
     secure_string_.Append(decrypted_char);
-    ++index;
   }
   secure_string_.Finalise();
-  encrypted_chars_.clear();
+  encrypted_chars_.Clear();
   finalised_ = true;
   return;
 }
@@ -237,25 +306,40 @@ bool SecureInputString<Predicate, Size>::IsFinalised() const {
 
 template<typename Predicate, SecureString::size_type Size>
 bool SecureInputString<Predicate, Size>::IsValid(const boost::regex& regex) const {
+  return IsValid(CharacterValidator::Cached(regex));
+}
+
+template<typename Predicate, SecureString::size_type Size>
+bool SecureInputString<Predicate, Size>::IsValid(const CharacterValidator& validator) const {
   if (IsFinalised())
-    return ValidateSecureString(regex);
+    return ValidateSecureString(validator);
   else
-    return ValidateEncryptedChars(regex);
+    return ValidateEncryptedChars(validator);
 }
 
 template<typename Predicate, SecureString::size_type Size> template<typename HashType>
 typename SecureString::Hash SecureInputString<Predicate, Size>::Hash() const {
   if (!IsFinalised())
     ThrowError(CommonErrors::symmetric_encryption_error);
-  return crypto::Hash<HashType>(secure_string_.string());
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  auto it(hashes_.find(typeid(HashType)));
+  if (it == hashes_.end()) {
+    SecureString::Hash hash(crypto::Hash<HashType>(secure_string_.string()));
+    it = hashes_.insert(std::make_pair(std::type_index(typeid(HashType)), hash)).first;
+  }
+  return it->second;
 }
 
 template<typename Predicate, SecureString::size_type Size>
 typename SecureString::size_type SecureInputString<Predicate, Size>::Value() const {
   if (!IsFinalised())
     ThrowError(CommonErrors::symmetric_encryption_error);
-  SafeString decrypted_string(secure_string_.string());
-  return std::stoul(std::string(decrypted_string.begin(), decrypted_string.end()));
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  if (value_.empty()) {
+    SafeString decrypted_string(secure_string_.string());
+    value_.push_back(std::stoul(std::string(decrypted_string.begin(), decrypted_string.end())));
+  }
+  return value_.front();
 }
 
 template<typename Predicate, SecureString::size_type Size>
@@ -268,71 +352,65 @@ SafeString SecureInputString<Predicate, Size>::string() const {
 template<typename Predicate, SecureString::size_type Size>
 void SecureInputString<Predicate, Size>::Reset() {
   SafeString decrypted_string(string());
-  encrypted_chars_.clear();
+  encrypted_chars_.Clear();
   size_type decrypted_string_size(decrypted_string.size());
-  for (size_type i = 0; i != decrypted_string_size; ++i) {
-    SafeString encrypted_char(Encrypt(decrypted_string[i]));
-    encrypted_chars_.insert(std::make_pair(i, encrypted_char));
-  }
+  for (size_type i = 0; i != decrypted_string_size; ++i)
+    encrypted_chars_.Insert(i, Encrypt(decrypted_string[i]));
   secure_string_.Clear();
+  ClearCache();
   finalised_ = false;
   return;
 }
 
+template<typename Predicate, SecureString::size_type Size>
+void SecureInputString<Predicate, Size>::ClearCache() {
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  hashes_.clear();
+  value_.clear();
+}
+
 template<typename Predicate, SecureString::size_type Size>
 SafeString SecureInputString<Predicate, Size>::Encrypt(const char& decrypted_char) const {
-  SafeString encrypted_char;
-  Encryptor encryptor(phrase_.data(), new Encoder(new Sink(encrypted_char)));
-  encryptor.Put(decrypted_char);
-  encryptor.MessageEnd();
-  return encrypted_char;
+  return cipher_.Encrypt(&decrypted_char, 1);
 }
 
 template<typename Predicate, SecureString::size_type Size> template<typename StringType>
 SafeString SecureInputString<Predicate, Size>::Encrypt(const StringType& decrypted_chars) const {
-  SafeString encrypted_chars;
-  Encryptor encryptor(phrase_.data(), new Encoder(new Sink(encrypted_chars)));
-  encryptor.Put(reinterpret_cast<const byte*>(decrypted_chars.data()), decrypted_chars.size());
-  encryptor.MessageEnd();
-  return encrypted_chars;
+  return cipher_.Encrypt(decrypted_chars.data(), decrypted_chars.size());
 }
 
 template<typename Predicate, SecureString::size_type Size>
 SafeString SecureInputString<Predicate, Size>::Decrypt(const SafeString& encrypted_char) const {
-  SafeString decrypted_char;
-  Decoder decryptor(new Decryptor(phrase_.data(), new Sink(decrypted_char)));
-  decryptor.Put(reinterpret_cast<const byte*>(encrypted_char.data()), encrypted_char.length());
-  decryptor.MessageEnd();
-  return decrypted_char;
+  return cipher_.Decrypt(encrypted_char);
 }
 
 template<typename Predicate, SecureString::size_type Size>
-bool SecureInputString<Predicate, Size>::ValidateEncryptedChars(const boost::regex& regex) const {
-  if (!Predicate()(encrypted_chars_.size(), Size))
+bool SecureInputString<Predicate, Size>::ValidateEncryptedChars(
+    const CharacterValidator& validator) const {
+  if (!Predicate()(encrypted_chars_.entry_count(), Size))
     return false;
-  uint32_t counter(0);
-  for (auto& encrypted_char : encrypted_chars_) {
-    if (encrypted_char.first != counter)
+  for (size_type i(0); i != encrypted_chars_.size(); ++i) {
+    if (encrypted_chars_[i].empty())
       return false;
-    SafeString decrypted_char(Decrypt(encrypted_char.second));
-    if (!boost::regex_search(decrypted_char, regex))
+    SafeString decrypted_chars(Decrypt(encrypted_chars_[i]));
+    if (decrypted_chars.size() == 1) {
+      if (!validator.IsValid(decrypted_chars[0]))
+        return false;
+    } else if (!boost::regex_search(decrypted_chars.begin(), decrypted_chars.end(),
+                                    validator.regex())) {
       return false;
-    ++counter;
+    }
   }
   return true;
 }
 
 template<typename Predicate, SecureString::size_type Size>
-bool SecureInputString<Predicate, Size>::ValidateSecureString(const boost::regex& regex) const {
+bool SecureInputString<Predicate, Size>::ValidateSecureString(
+    const CharacterValidator& validator) const {
   SafeString decrypted_string(string());
-  size_type decrypted_string_size(decrypted_string.size());
-  if (!Predicate()(decrypted_string_size, Size))
+  if (!Predicate()(decrypted_string.size(), Size))
     return false;
-  for (size_type i = 0; i != decrypted_string_size; ++i) {
-    if (!boost::regex_search(SafeString(1, decrypted_string[i]), regex))
-      return false;
-  }
-  return true;
+  return validator.IsValid(decrypted_string.data(), decrypted_string.size());
 }
 
 
@@ -0,0 +1,184 @@
+/*  Copyright 2013 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_PASSPORT_DETAIL_SIGNATURE_SCHEME_H_
+#define MAIDSAFE_PASSPORT_DETAIL_SIGNATURE_SCHEME_H_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef __MSVC__
+#  pragma warning(push, 1)
+#endif
+#include "cryptopp/eccrypto.h"
+#include "cryptopp/oids.h"
+#include "cryptopp/pssr.h"
+#include "cryptopp/rsa.h"
+#include "cryptopp/sha.h"
+#ifdef __MSVC__
+#  pragma warning(pop)
+#endif
+
+#include "maidsafe/common/crypto.h"
+#include "maidsafe/common/rsa.h"
+#include "maidsafe/common/types.h"
+
+#include "maidsafe/passport/detail/config.h"
+
+
+namespace maidsafe {
+namespace passport {
+namespace detail {
+
+// Identifies the signature scheme of a serialised fob.  These values are persisted, so must never
+// be changed or reused.
+enum class SignatureSchemeId : uint32_t { kRsa = 0, kEcdsa = 1 };
+
+// RSA-PSS with SHA-512, as used by asymm::Sign and asymm::CheckSignature.  This is the scheme of
+// all existing identity types.
+struct RsaScheme {
+  typedef CryptoPP::RSASS<CryptoPP::PSS, CryptoPP::SHA512>::Signer Signer;
+  typedef CryptoPP::RSASS<CryptoPP::PSS, CryptoPP::SHA512>::Verifier Verifier;
+  typedef asymm::PrivateKey PrivateKey;
+  typedef asymm::PublicKey PublicKey;
+  typedef asymm::Keys Keys;
+  static const SignatureSchemeId kId = SignatureSchemeId::kRsa;
+
+  static Keys GenerateKeyPair();
+  static NonEmptyString EncodeKey(const PrivateKey& private_key);
+  static NonEmptyString EncodeKey(const PublicKey& public_key);
+  static PrivateKey DecodePrivateKey(const NonEmptyString& encoded_private_key);
+  static PublicKey DecodePublicKey(const NonEmptyString& encoded_public_key);
+  static asymm::Signature Sign(const asymm::PlainText& data, const PrivateKey& private_key);
+  static bool CheckSignature(const asymm::PlainText& data,
+                             const asymm::Signature& signature,
+                             const PublicKey& public_key);
+  static bool MatchingKeys(const PrivateKey& private_key, const PublicKey& public_key);
+  static asymm::PlainText Decrypt(const asymm::CipherText& data, const PrivateKey& private_key);
+};
+
+// ECDSA on curve P-256 with SHA-512.  Key generation and signing are orders of magnitude faster
+// than for RSA, and keys and signatures are much smaller.  This scheme doesn't support encryption.
+struct EcdsaScheme {
+  typedef CryptoPP::ECDSA<CryptoPP::ECP, CryptoPP::SHA512> Ecdsa;
+  typedef Ecdsa::Signer Signer;
+  typedef Ecdsa::Verifier Verifier;
+  typedef Ecdsa::PrivateKey PrivateKey;
+  typedef Ecdsa::PublicKey PublicKey;
+  struct Keys {
+    Keys() : private_key(), public_key() {}
+    PrivateKey private_key;
+    PublicKey public_key;
+  };
+  static const SignatureSchemeId kId = SignatureSchemeId::kEcdsa;
+
+  static Keys GenerateKeyPair();
+  static NonEmptyString EncodeKey(const PrivateKey& private_key);
+  static NonEmptyString EncodeKey(const PublicKey& public_key);
+  static PrivateKey DecodePrivateKey(const NonEmptyString& encoded_private_key);
+  static PublicKey DecodePublicKey(const NonEmptyString& encoded_public_key);
+  static asymm::Signature Sign(const asymm::PlainText& data, const PrivateKey& private_key);
+  static bool CheckSignature(const asymm::PlainText& data,
+                             const asymm::Signature& signature,
+                             const PublicKey& public_key);
+  static bool MatchingKeys(const PrivateKey& private_key, const PublicKey& public_key);
+};
+
+// The scheme used by the fobs of a given tag.  Changing this for an existing tag would make
+// previously serialised fobs of that tag unparsable, so only new identity types should select a
+// scheme other than RSA.
+template<typename Tag>
+struct SignatureScheme {
+  typedef RsaScheme type;
+};
+
+
+// Thread-safe signer for a single private key, shared by all copies of a Fob.  The key is validated
+// on first use.  CryptoPP signers aren't safe for concurrent use even through const calls (ECDSA
+// point arithmetic writes to mutable scratch values), so each signing operation borrows a signer
+// for exclusive use from a pool held here, building a new one only when every pooled signer is
+// busy.  The pool is therefore bounded by the number of threads ever signing concurrently.  A pool
+// is used rather than a thread-specific signer because the latter would outlive a destroyed Fob in
+// every thread which had used it.  Each calling thread uses its own random number generator.
+template<typename Scheme>
+class CachedSigner {
+ public:
+  typedef typename Scheme::Signer Signer;
+  typedef typename Scheme::PrivateKey PrivateKey;
+
+  CachedSigner();
+  asymm::Signature Sign(const PrivateKey& private_key, const asymm::PlainText& data) const;
+  std::vector<asymm::Signature> Sign(const PrivateKey& private_key,
+                                     const std::vector<asymm::PlainText>& data) const;
+  // As Sign, but also sets 'digest' to the SHA-512 hash of 'data'.  Both schemes sign this digest,
+  // so it's taken from the signature's own hashing pass rather than computed separately.
+  asymm::Signature Sign(const PrivateKey& private_key,
+                        const asymm::PlainText& data,
+                        crypto::SHA512Hash& digest) const;
+
+ private:
+  CachedSigner(const CachedSigner&);
+  CachedSigner& operator=(const CachedSigner&);
+  std::unique_ptr<Signer> NewSigner(const PrivateKey& private_key) const;
+
+  mutable std::once_flag once_flag_;
+  mutable std::mutex mutex_;
+  mutable std::vector<std::unique_ptr<Signer>> idle_signers_;
+};
+
+// Thread-safe verifier for a single public key, shared by all copies of a PublicFob.  The key is
+// validated on first use.  As with CachedSigner, each verification borrows a CryptoPP verifier
+// (precomputed where the key type supports it) for exclusive use from a pool, since those aren't
+// safe for concurrent use; a new one is built only when every pooled verifier is busy.
+template<typename Scheme>
+class CachedVerifier {
+ public:
+  typedef typename Scheme::Verifier Verifier;
+  typedef typename Scheme::PublicKey PublicKey;
+
+  CachedVerifier();
+  bool Verify(const PublicKey& public_key,
+              const asymm::PlainText& data,
+              const asymm::Signature& signature) const;
+  // As Verify, but also sets 'digest' to the SHA-512 hash of 'data', which is computed even if
+  // verification fails.
+  bool Verify(const PublicKey& public_key,
+              const asymm::PlainText& data,
+              const asymm::Signature& signature,
+              crypto::SHA512Hash& digest) const;
+  // Validates the key and builds a verifier now rather than on the first call to Verify.  Intended
+  // for keys which are used for very many verifications.
+  void Precompute(const PublicKey& public_key) const;
+
+ private:
+  CachedVerifier(const CachedVerifier&);
+  CachedVerifier& operator=(const CachedVerifier&);
+  std::unique_ptr<Verifier> NewVerifier(const PublicKey& public_key) const;
+
+  mutable std::once_flag once_flag_;
+  mutable std::mutex mutex_;
+  mutable std::vector<std::unique_ptr<Verifier>> idle_verifiers_;
+};
+
+}  // namespace detail
+}  // namespace passport
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_PASSPORT_DETAIL_SIGNATURE_SCHEME_H_
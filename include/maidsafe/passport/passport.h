@@ -20,9 +20,11 @@
 #define MAIDSAFE_PASSPORT_PASSPORT_H_
 
 #include <cstdint>
+#include <istream>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <ostream>
 
 #include "maidsafe/common/rsa.h"
 #include "maidsafe/common/types.h"
@@ -52,7 +54,8 @@ namespace passport {
 // of the http://www.novinet.com/library-common project. The following methods are used for
 // self-authenticated network identity' storage/retrieval on the network.
 
-// Encrypts a users credentials prior to network storage.
+// Encrypts a users credentials prior to network storage, in the original unauthenticated format.
+// The authenticated format is written by a LoginContext constructed with a kFixed KdfPolicy.
 EncryptedSession EncryptSession(const detail::Keyword& keyword,
                                 const detail::Pin& pin,
                                 const detail::Password& password,
@@ -75,6 +78,28 @@ Tmid::Name DecryptTmidName(const detail::Keyword& keyword,
 Mid::Name MidName(const detail::Keyword& keyword, const detail::Pin& pin);
 Smid::Name SmidName(const detail::Keyword& keyword, const detail::Pin& pin);
 
+// Equivalents of the above which reuse the material already derived for a single login, avoiding
+// repeated PBKDF2 work when several of these are needed together.  See detail::LoginContext.
+typedef detail::LoginContext LoginContext;
+typedef detail::SessionCompression SessionCompression;
+EncryptedSession EncryptSession(const LoginContext& login_context,
+                                const NonEmptyString& serialised_session,
+                                SessionCompression compression = SessionCompression::kNone);
+NonEmptyString DecryptSession(const LoginContext& login_context,
+                              const EncryptedSession& encrypted_session);
+EncryptedTmidName EncryptTmidName(const LoginContext& login_context, const Tmid::Name& tmid_name);
+Tmid::Name DecryptTmidName(const LoginContext& login_context,
+                           const EncryptedTmidName& encrypted_tmid_name);
+Mid::Name MidName(const LoginContext& login_context);
+Smid::Name SmidName(const LoginContext& login_context);
+
+// Streaming session encryption for large sessions.  See detail::LoginContext.
+void EncryptSession(const LoginContext& login_context,
+                    std::istream& source,
+                    std::ostream& sink,
+                    SessionCompression compression = SessionCompression::kNone);
+void DecryptSession(const LoginContext& login_context, std::istream& source, std::ostream& sink);
+
 // Methods for serialising/parsing the identity required for data storage.
 NonEmptyString SerialisePmid(const Pmid& pmid);
 Pmid ParsePmid(const NonEmptyString& serialised_pmid);
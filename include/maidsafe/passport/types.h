@@ -74,6 +74,12 @@ typedef detail::MidData<detail::SmidTag> Smid;
 typedef detail::Fob<detail::AnmidTag> Anmid;
 typedef detail::Fob<detail::AnsmidTag> Ansmid;
 
+// Read-only views of serialised Mid, Smid and Tmid/Stmid packets which validate the packet but
+// refer into the serialised data rather than copying its fields.
+typedef detail::MidDataView<detail::MidTag> MidView;
+typedef detail::MidDataView<detail::SmidTag> SmidView;
+typedef detail::TmidDataView TmidView, StmidView;
+
 // Public key types allowing peers to validate digitally signed requests made by nodes on the
 // network. Typically used to authenticate requesting nodes or to check data integrity. The digital
 // signatures are generated using the RSA-probabilistic signature scheme, RSA-PSS, more information
@@ -0,0 +1,77 @@
+/*  Copyright 2013 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/passport/detail/chain_validator.h"
+
+#include "maidsafe/common/log.h"
+
+
+namespace maidsafe {
+namespace passport {
+namespace detail {
+
+ChainValidator::ChainValidator(size_t max_cached_links)
+    : kMaxCachedLinks_(max_cached_links),
+      mutex_(),
+      verified_links_(),
+      insertion_order_() {}
+
+bool ChainValidator::Validate(const PublicFob<AnmaidTag>& anmaid,
+                              const PublicFob<MaidTag>& maid,
+                              const PublicFob<PmidTag>& pmid) {
+  if (!NameIsValid(anmaid) || !NameIsValid(maid) || !NameIsValid(pmid)) {
+    LOG(kWarning) << "Chain contains a fob whose name doesn't match its key and token.";
+    return false;
+  }
+  if (!LinkIsValid(anmaid, anmaid) || !LinkIsValid(maid, anmaid) || !LinkIsValid(pmid, maid)) {
+    LOG(kWarning) << "Chain contains a fob with a bad validation token.";
+    return false;
+  }
+  return true;
+}
+
+void ChainValidator::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  verified_links_.clear();
+  insertion_order_.clear();
+}
+
+size_t ChainValidator::CachedLinkCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return verified_links_.size();
+}
+
+bool ChainValidator::IsCached(const Link& link) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return verified_links_.find(link) != verified_links_.end();
+}
+
+void ChainValidator::Cache(const Link& link) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (kMaxCachedLinks_ == 0 || !verified_links_.insert(link).second)
+    return;
+  insertion_order_.push_back(link);
+  while (insertion_order_.size() > kMaxCachedLinks_) {
+    verified_links_.erase(insertion_order_.front());
+    insertion_order_.pop_front();
+  }
+}
+
+}  // namespace detail
+}  // namespace passport
+}  // namespace maidsafe
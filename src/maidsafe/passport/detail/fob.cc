@@ -18,6 +18,20 @@
 
 #include "maidsafe/passport/detail/fob.h"
 
+#include <algorithm>
+#include <future>
+#include <thread>
+
+#ifdef __MSVC__
+#  pragma warning(push, 1)
+#endif
+#include "cryptopp/filters.h"
+#include "cryptopp/sha.h"
+#ifdef __MSVC__
+#  pragma warning(pop)
+#endif
+
+#include "maidsafe/common/error.h"
 #include "maidsafe/common/utils.h"
 #include "maidsafe/passport/detail/passport.pb.h"
 
@@ -26,9 +40,103 @@ namespace maidsafe {
 namespace passport {
 namespace detail {
 
-Identity CreateFobName(const asymm::PublicKey& public_key,
+namespace {
+
+// Fewer names than this per thread aren't worth the cost of starting the thread.
+const size_t kMinFobNamesPerThread(64);
+
+// Streams the DER-encoded key and then the token through the hash, rather than hashing their
+// concatenation, so no temporary copies of either are made.
+template<typename PublicKey>
+Identity HashFobName(const PublicKey& public_key, const asymm::Signature& validation_token) {
+  CryptoPP::SHA512 hash;
+  std::string digest(crypto::SHA512::DIGESTSIZE, 0);
+  CryptoPP::HashFilter hash_filter(hash,
+      new CryptoPP::ArraySink(reinterpret_cast<byte*>(&digest[0]), digest.size()));
+  public_key.DEREncode(hash_filter);
+  hash_filter.Put(reinterpret_cast<const byte*>(validation_token.string().data()),
+                  validation_token.string().size());
+  hash_filter.MessageEnd();
+  return Identity(digest);
+}
+
+template<typename Scheme>
+void ParseFob(const protobuf::Fob& proto_fob,
+              DataTagValue enum_value,
+              typename Scheme::Keys& keys,
+              asymm::Signature& validation_token,
+              Identity& name) {
+  if (!proto_fob.IsInitialized() ||
+      proto_fob.signature_scheme() != static_cast<uint32_t>(Scheme::kId)) {
+    ThrowError(PassportErrors::fob_parsing_error);
+  }
+
+  validation_token = asymm::Signature(proto_fob.validation_token());
+  name = Identity(proto_fob.name());
+
+  keys.private_key = Scheme::DecodePrivateKey(NonEmptyString(proto_fob.encoded_private_key()));
+  keys.public_key = Scheme::DecodePublicKey(NonEmptyString(proto_fob.encoded_public_key()));
+  if ((enum_value != MpidTag::kValue && CreateFobName(keys.public_key, validation_token) != name) ||
+      !Scheme::MatchingKeys(keys.private_key, keys.public_key) ||
+      enum_value != DataTagValue(proto_fob.type())) {
+    ThrowError(PassportErrors::fob_parsing_error);
+  }
+}
+
+// RSA fobs leave signature_scheme at its default, so are serialised exactly as before it existed.
+template<typename Scheme>
+void SerialiseFob(DataTagValue enum_value,
+                  const typename Scheme::Keys& keys,
+                  const asymm::Signature& validation_token,
+                  const std::string& name,
+                  protobuf::Fob* proto_fob) {
+  proto_fob->set_type(static_cast<uint32_t>(enum_value));
+  proto_fob->set_name(name);
+  proto_fob->set_encoded_private_key(Scheme::EncodeKey(keys.private_key).string());
+  proto_fob->set_encoded_public_key(Scheme::EncodeKey(keys.public_key).string());
+  proto_fob->set_validation_token(validation_token.string());
+  if (Scheme::kId != SignatureSchemeId::kRsa)
+    proto_fob->set_signature_scheme(static_cast<uint32_t>(Scheme::kId));
+}
+
+}  // unnamed namespace
+
+Identity CreateFobName(const RsaScheme::PublicKey& public_key,
+                       const asymm::Signature& validation_token) {
+  return HashFobName(public_key, validation_token);
+}
+
+Identity CreateFobName(const EcdsaScheme::PublicKey& public_key,
                        const asymm::Signature& validation_token) {
-  return Identity(crypto::Hash<crypto::SHA512>(asymm::EncodeKey(public_key) + validation_token));
+  return HashFobName(public_key, validation_token);
+}
+
+std::vector<Identity> CreateFobNames(const std::vector<asymm::PublicKey>& public_keys,
+                                     const std::vector<asymm::Signature>& validation_tokens) {
+  if (public_keys.size() != validation_tokens.size())
+    ThrowError(CommonErrors::invalid_parameter);
+  std::vector<Identity> names(public_keys.size());
+  auto create_names([&](size_t begin, size_t end) {
+    for (size_t i(begin); i != end; ++i)
+      names[i] = HashFobName(public_keys[i], validation_tokens[i]);
+  });
+
+  size_t thread_count(std::min(static_cast<size_t>(std::thread::hardware_concurrency()),
+                               names.size() / kMinFobNamesPerThread));
+  if (thread_count < 2) {
+    create_names(0, names.size());
+    return names;
+  }
+
+  std::vector<std::future<void>> results;
+  size_t batch_size((names.size() + thread_count - 1) / thread_count);
+  for (size_t begin(0); begin < names.size(); begin += batch_size) {
+    results.push_back(std::async(std::launch::async, create_names, begin,
+                                 std::min(begin + batch_size, names.size())));
+  }
+  for (auto& result : results)
+    result.get();
+  return names;
 }
 
 Identity CreateMpidName(const NonEmptyString& chosen_name) {
@@ -37,69 +145,77 @@ Identity CreateMpidName(const NonEmptyString& chosen_name) {
 
 void FobFromProtobuf(const protobuf::Fob& proto_fob,
                      DataTagValue enum_value,
-                     asymm::Keys& keys,
+                     RsaScheme::Keys& keys,
                      asymm::Signature& validation_token,
                      Identity& name) {
-  if (!proto_fob.IsInitialized())
-    ThrowError(PassportErrors::fob_parsing_error);
+  ParseFob<RsaScheme>(proto_fob, enum_value, keys, validation_token, name);
+}
 
-  validation_token = asymm::Signature(proto_fob.validation_token());
-  name = Identity(proto_fob.name());
+void FobFromProtobuf(const protobuf::Fob& proto_fob,
+                     DataTagValue enum_value,
+                     EcdsaScheme::Keys& keys,
+                     asymm::Signature& validation_token,
+                     Identity& name) {
+  ParseFob<EcdsaScheme>(proto_fob, enum_value, keys, validation_token, name);
+}
 
-  asymm::PlainText plain(RandomString(64));
-  keys.private_key = asymm::DecodeKey(asymm::EncodedPrivateKey(proto_fob.encoded_private_key()));
-  keys.public_key = asymm::DecodeKey(asymm::EncodedPublicKey(proto_fob.encoded_public_key()));
-  if ((enum_value != MpidTag::kValue && CreateFobName(keys.public_key, validation_token) != name) ||
-      asymm::Decrypt(asymm::Encrypt(plain, keys.public_key), keys.private_key) != plain ||
-      enum_value != DataTagValue(proto_fob.type())) {
-    ThrowError(PassportErrors::fob_parsing_error);
-  }
+void FobToProtobuf(DataTagValue enum_value,
+                   const RsaScheme::Keys& keys,
+                   const asymm::Signature& validation_token,
+                   const std::string& name,
+                   protobuf::Fob* proto_fob) {
+  SerialiseFob<RsaScheme>(enum_value, keys, validation_token, name, proto_fob);
 }
 
 void FobToProtobuf(DataTagValue enum_value,
-                   const asymm::Keys& keys,
+                   const EcdsaScheme::Keys& keys,
                    const asymm::Signature& validation_token,
                    const std::string& name,
                    protobuf::Fob* proto_fob) {
-  proto_fob->set_type(static_cast<uint32_t>(enum_value));
-  proto_fob->set_name(name);
-  proto_fob->set_encoded_private_key(asymm::EncodeKey(keys.private_key).string());
-  proto_fob->set_encoded_public_key(asymm::EncodeKey(keys.public_key).string());
-  proto_fob->set_validation_token(validation_token.string());
+  SerialiseFob<EcdsaScheme>(enum_value, keys, validation_token, name, proto_fob);
 }
 
 
 Fob<MpidTag>::Fob(const Fob<MpidTag>& other)
     : keys_(other.keys_),
       validation_token_(other.validation_token_),
-      name_(other.name_) {}
+      name_(other.name_),
+      signer_(other.signer_) {}
 
 Fob<MpidTag>::Fob(const NonEmptyString& chosen_name, const signer_type& signing_fob)
-    : keys_(asymm::GenerateKeyPair()),
-      validation_token_(asymm::Sign(asymm::PlainText(asymm::EncodeKey(keys_.public_key)),
-                                    signing_fob.private_key())),
-      name_(CreateMpidName(chosen_name)) {}
+    : keys_(scheme_type::GenerateKeyPair()),
+      validation_token_(
+          signing_fob.Sign(asymm::PlainText(scheme_type::EncodeKey(keys_.public_key)))),
+      name_(CreateMpidName(chosen_name)),
+      signer_(std::make_shared<CachedSigner<scheme_type>>()) {}
 
 Fob<MpidTag>& Fob<MpidTag>::operator=(const Fob<MpidTag>& other) {
   keys_ = other.keys_;
   validation_token_ = other.validation_token_;
   name_ = other.name_;
+  signer_ = other.signer_;
   return *this;
 }
 
 Fob<MpidTag>::Fob(Fob<MpidTag>&& other)
     : keys_(std::move(other.keys_)),
       validation_token_(std::move(other.validation_token_)),
-      name_(std::move(other.name_)) {}
+      name_(std::move(other.name_)),
+      signer_(other.signer_) {}
 
 Fob<MpidTag>& Fob<MpidTag>::operator=(Fob<MpidTag>&& other) {
   keys_ = std::move(other.keys_);
   validation_token_ = std::move(other.validation_token_);
   name_ = std::move(other.name_);
+  signer_ = other.signer_;
   return *this;
 }
 
-Fob<MpidTag>::Fob(const protobuf::Fob& proto_fob) : keys_(), validation_token_(), name_() {
+Fob<MpidTag>::Fob(const protobuf::Fob& proto_fob)
+    : keys_(),
+      validation_token_(),
+      name_(),
+      signer_(std::make_shared<CachedSigner<scheme_type>>()) {
   Identity name;
   FobFromProtobuf(proto_fob, MpidTag::kValue, keys_, validation_token_, name);
   name_ = Name(name);
@@ -18,12 +18,40 @@
 
 #include "maidsafe/passport/detail/identity_data.h"
 
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <future>
 #include <limits>
+#include <map>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/wire_format_lite.h"
+
+#ifdef __MSVC__
+#  pragma warning(push, 1)
+#endif
+#include "cryptopp/aes.h"
+#include "cryptopp/gcm.h"
+#include "cryptopp/hmac.h"
+#include "cryptopp/modes.h"
+#include "cryptopp/pwdbased.h"
+#include "cryptopp/sha.h"
+#include "cryptopp/zdeflate.h"
+#include "cryptopp/zinflate.h"
+#ifdef __MSVC__
+#  pragma warning(pop)
+#endif
 
 #include "maidsafe/common/utils.h"
 
 #include "maidsafe/passport/detail/fob.h"
+#include "maidsafe/passport/detail/public_fob.h"
 #include "maidsafe/passport/detail/passport.pb.h"
+#include "maidsafe/passport/detail/safe_allocators.h"
 
 namespace maidsafe {
 namespace passport {
@@ -31,49 +59,714 @@ namespace detail {
 
 namespace {
 
-crypto::AES256Key SecureKey(const crypto::SecurePassword& secure_password) {
-  return crypto::AES256Key(secure_password.string().substr(0, crypto::AES256_KeySize));
+// Presents input which has already been decrypted to crypto::CreateSecurePassword, which would
+// otherwise decrypt a SecureInputString each time it reads it.
+class DecryptedInput {
+ public:
+  explicit DecryptedInput(const SafeString& string) : string_(string) {}
+  bool IsInitialised() const { return !string_.empty(); }
+  const SafeString& string() const { return string_; }
+
+ private:
+  const SafeString& string_;
+};
+
+SafeString ToSafeString(const crypto::SecurePassword& secure_password) {
+  return SafeString(secure_password.string().begin(), secure_password.string().end());
 }
 
-crypto::AES256InitialisationVector SecureIv(const crypto::SecurePassword& secure_password) {
+crypto::AES256Key SecureKey(const SafeString& secure_password) {
+  return crypto::AES256Key(std::string(secure_password.data(), crypto::AES256_KeySize));
+}
+
+crypto::AES256InitialisationVector SecureIv(const SafeString& secure_password) {
   return crypto::AES256InitialisationVector(
-      secure_password.string().substr(crypto::AES256_KeySize, crypto::AES256_IVSize));
+      std::string(secure_password.data() + crypto::AES256_KeySize, crypto::AES256_IVSize));
 }
 
-crypto::SecurePassword CreateSecureMidPassword(const Keyword& keyword, const Pin& pin) {
-  crypto::Salt salt(crypto::Hash<crypto::SHA512>(pin.string() + keyword.string()));
-  assert(pin.Value() <= std::numeric_limits<uint32_t>::max());
-  return crypto::CreateSecurePassword<Keyword>(keyword, salt, static_cast<uint32_t>(pin.Value()));
+uint32_t PinValue(const SafeString& pin) {
+  SecureString::size_type pin_value(std::stoul(std::string(pin.begin(), pin.end())));
+  assert(pin_value <= std::numeric_limits<uint32_t>::max());
+  return static_cast<uint32_t>(pin_value);
 }
 
-crypto::SecurePassword CreateSecureTmidPassword(const Password& password, const Pin& pin) {
-  crypto::Salt salt(crypto::Hash<crypto::SHA512>(pin.Hash<crypto::SHA512>() + password.string()));
-  assert(pin.Value() <= std::numeric_limits<uint32_t>::max());
-  return crypto::CreateSecurePassword<Password>(password, salt, static_cast<uint32_t>(pin.Value()));
+// Sessions and Tmid names may be in one of several formats.  Data written under
+// KdfPolicy::kPinScaled is unversioned: the raw output of crypto::SymmEncrypt.  The versioned
+// formats are a format tag followed by a serialised protobuf message whose last field is the cipher
+// text:
+//  * protobuf::VersionedCipherText, used for Tmid names, and for sessions written before the
+//    authenticated format was introduced.  Sessions in this format are obfuscated by XorData before
+//    encryption, exactly as unversioned sessions are.
+//  * protobuf::AuthenticatedSession, used for sessions.  This is a single AES-GCM pass keyed by the
+//    Tmid password's first 32 bytes.  Its remaining 16 bytes key an HMAC which provides a key check
+//    value, so that a wrong password is rejected before any decryption, and the GCM nonce, which is
+//    synthesised from the plaintext.  The nonce keeps encryption deterministic, as it has always
+//    been, without reusing a nonce for different plaintexts under the same key.  If the optional
+//    compression field is set, the plaintext is the deflated session; the nonce is then synthesised
+//    under a separate domain and the compression value is authenticated as additional data.
+const std::string kVersionedCipherTextTag("\xffKDF", 4);
+const std::string kAuthenticatedSessionTag("\xffGCM", 4);
+const size_t kFormatTagSize(4);
+
+// Field tags of the length-delimited protobuf fields holding the cipher text.
+const char kVersionedCipherTextFieldTag('\x12');
+const char kAuthenticatedSessionFieldTag('\x22');
+
+const size_t kNonceSize(12);
+const size_t kMacSize(16);
+const size_t kKeyCheckSize(8);
+const byte kKeyCheckDomain(0);
+const byte kNonceDomain(1);
+const byte kDeflatedNonceDomain(2);
+
+// Favours speed over ratio: sessions are mostly repetitive, so compress well even at this level.
+const int kDeflateLevel(1);
+
+typedef CryptoPP::HMAC<CryptoPP::SHA512> SessionHmac;
+
+const size_t kObfuscationKeySize(crypto::AES256_KeySize + crypto::AES256_IVSize);
+const size_t kObfuscationBlockSize(kObfuscationKeySize * sizeof(uint64_t));
+
+// Streamed sessions are processed in chunks of this size.  The chunk buffer is locked memory, which
+// is a limited resource, so this is kept small.
+const size_t kSessionChunkSize(16 * 1024);
+
+// Passed to StreamSession to process the remainder of its source, however long.
+const uint64_t kUnboundedSessionSize(std::numeric_limits<uint64_t>::max());
+
+// Fewer packets than this per thread aren't worth the cost of starting the thread.  Each packet
+// costs a signature verification, so this is much lower than the equivalent for fob names.
+const size_t kMinPacketsPerThread(16);
+
+// PBKDF2 with an explicit iteration count, yielding an AES-256 key followed by an IV.
+SafeString DeriveSecurePassword(const SafeString& input,
+                                const crypto::Salt& salt,
+                                uint32_t iterations) {
+  CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA512> pbkdf;
+  SafeString derived(crypto::AES256_KeySize + crypto::AES256_IVSize, 0);
+  pbkdf.DeriveKey(reinterpret_cast<byte*>(&derived[0]), derived.size(), 0,
+                  reinterpret_cast<const byte*>(input.data()), input.size(),
+                  reinterpret_cast<const byte*>(salt.string().data()), salt.string().size(),
+                  iterations);
+  return derived;
+}
+
+SafeString CreateSecurePassword(const SafeString& input,
+                                const crypto::Salt& salt,
+                                uint32_t pin_scaled_rounds,
+                                const KdfPolicy& kdf_policy) {
+  if (kdf_policy.version == KdfPolicy::Version::kPinScaled) {
+    return ToSafeString(crypto::CreateSecurePassword(DecryptedInput(input), salt,
+                                                     pin_scaled_rounds));
+  }
+  return DeriveSecurePassword(input, salt, kdf_policy.iterations);
+}
+
+SafeString CreateSecureMidPassword(const SafeString& keyword,
+                                   const SafeString& pin,
+                                   uint32_t pin_value,
+                                   const KdfPolicy& kdf_policy) {
+  crypto::Salt salt(crypto::Hash<crypto::SHA512>(pin + keyword));
+  return CreateSecurePassword(keyword, salt, pin_value, kdf_policy);
+}
+
+SafeString CreateSecureTmidPassword(const SafeString& password,
+                                    const SecureString::Hash& pin_hash,
+                                    uint32_t pin_value,
+                                    const KdfPolicy& kdf_policy) {
+  crypto::Salt salt(crypto::Hash<crypto::SHA512>(pin_hash + password));
+  return CreateSecurePassword(password, salt, pin_value, kdf_policy);
 }
 
-NonEmptyString XorData(const Keyword& keyword,
-                       const Pin& pin,
-                       const Password& password,
-                       const NonEmptyString& data) {
-  assert(pin.Value() <= std::numeric_limits<uint32_t>::max());
-  uint32_t pin_value(static_cast<uint32_t>(pin.Value()));
+SafeString CreateObfuscationKey(const SafeString& keyword,
+                                const SafeString& password,
+                                const SecureString::Hash& pin_hash,
+                                uint32_t pin_value,
+                                const KdfPolicy& kdf_policy) {
   uint32_t rounds(pin_value / 2 == 0 ? (pin_value * 3) / 2 : pin_value / 2);
-  std::string obfuscation_str =
-      crypto::CreateSecurePassword<Keyword>(keyword,
-                                   crypto::Salt(crypto::Hash<crypto::SHA512>(
-                                                  password.string() + pin.Hash<crypto::SHA512>())),
-                                   rounds).string();
-  // make the obfuscation_str of same size for XOR
-  if (data.string().size() < obfuscation_str.size()) {
-    obfuscation_str.resize(data.string().size());
-  } else if (data.string().size() > obfuscation_str.size()) {
-    obfuscation_str.reserve(data.string().size());
-    while (data.string().size() > obfuscation_str.size())
-      obfuscation_str += obfuscation_str;
-    obfuscation_str.resize(data.string().size());
-  }
-  return NonEmptyString(crypto::XOR(data.string(), obfuscation_str));
+  crypto::Salt salt(crypto::Hash<crypto::SHA512>(password + pin_hash));
+  return CreateSecurePassword(keyword, salt, rounds, kdf_policy);
+}
+
+bool IsValidKdfPolicy(const protobuf::KdfPolicy& proto_kdf_policy) {
+  return proto_kdf_policy.version() == static_cast<uint32_t>(KdfPolicy::Version::kFixed) &&
+         proto_kdf_policy.iterations() >= KdfPolicy::kMinimumIterations;
+}
+
+NonEmptyString WrapCipherText(const KdfPolicy& kdf_policy, const crypto::CipherText& cipher_text) {
+  if (kdf_policy.version == KdfPolicy::Version::kPinScaled)
+    return cipher_text;
+  protobuf::VersionedCipherText proto_cipher_text;
+  proto_cipher_text.mutable_kdf_policy()->set_version(static_cast<uint32_t>(kdf_policy.version));
+  proto_cipher_text.mutable_kdf_policy()->set_iterations(kdf_policy.iterations);
+  proto_cipher_text.set_cipher_text(cipher_text.string());
+  return NonEmptyString(kVersionedCipherTextTag + proto_cipher_text.SerializeAsString());
+}
+
+// Returns false if 'data' is unversioned, leaving 'kdf_policy' and 'cipher_text' unchanged.
+bool UnwrapCipherText(const NonEmptyString& data,
+                      KdfPolicy& kdf_policy,
+                      crypto::CipherText& cipher_text) {
+  const std::string& serialised(data.string());
+  if (serialised.compare(0, kFormatTagSize, kVersionedCipherTextTag) != 0)
+    return false;
+  protobuf::VersionedCipherText proto_cipher_text;
+  if (!proto_cipher_text.ParseFromArray(serialised.data() + kFormatTagSize,
+                                        static_cast<int>(serialised.size() - kFormatTagSize)) ||
+      !IsValidKdfPolicy(proto_cipher_text.kdf_policy()) ||
+      proto_cipher_text.cipher_text().empty()) {
+    return false;
+  }
+  kdf_policy = KdfPolicy(proto_cipher_text.kdf_policy().iterations());
+  cipher_text = crypto::CipherText(proto_cipher_text.cipher_text());
+  return true;
+}
+
+// XORs 'size' bytes in place with 'keystream'.  This is done a word at a time, which compilers
+// further vectorise.
+void XorInPlace(byte* data, const byte* keystream, size_t size) {
+  size_t i(0);
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word, key_word;
+    std::memcpy(&word, data + i, sizeof(word));
+    std::memcpy(&key_word, keystream + i, sizeof(key_word));
+    word ^= key_word;
+    std::memcpy(data + i, &word, sizeof(word));
+  }
+  for (; i != size; ++i)
+    data[i] ^= keystream[i];
+}
+
+// Applies the repeating obfuscation key to 'data' in place, starting 'key_offset' bytes into the
+// key, and returns the key offset following 'data'.  Rather than materialising a pad as long as the
+// data, the key is tiled into a small stack block whose size is a multiple of the key size, so that
+// every block of data starts at the same point in the key.
+size_t ApplyObfuscation(const SafeString& obfuscation_key,
+                        size_t key_offset,
+                        byte* data,
+                        size_t size) {
+  assert(obfuscation_key.size() == kObfuscationKeySize && key_offset < kObfuscationKeySize);
+  byte block[kObfuscationBlockSize];
+  for (size_t i(0); i != kObfuscationBlockSize; ++i)
+    block[i] = static_cast<byte>(obfuscation_key[(key_offset + i) % kObfuscationKeySize]);
+  size_t done(0);
+  for (; done + kObfuscationBlockSize <= size; done += kObfuscationBlockSize)
+    XorInPlace(data + done, block, kObfuscationBlockSize);
+  XorInPlace(data + done, block, size - done);
+  SecureWipe(block, sizeof(block));
+  return (key_offset + size) % kObfuscationKeySize;
+}
+
+void WriteVarint(uint64_t value, std::string& output) {
+  while (value >= 0x80) {
+    output += static_cast<char>((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  output += static_cast<char>(value);
+}
+
+// Returns the serialisation of a versioned format up to the start of its cipher text bytes, so that
+// these can be written directly after it.  'message' holds every field other than the cipher text.
+template<typename Message>
+std::string CipherTextHeader(const std::string& format_tag,
+                             const Message& message,
+                             char cipher_text_field_tag,
+                             uint64_t cipher_text_size) {
+  std::string header(format_tag + message.SerializePartialAsString());
+  header += cipher_text_field_tag;
+  WriteVarint(cipher_text_size, header);
+  return header;
+}
+
+// Reads a header written by CipherTextHeader from a stream, retaining every byte read.
+class CipherTextHeaderReader {
+ public:
+  explicit CipherTextHeaderReader(std::istream& source) : source_(source), consumed_() {}
+
+  // Returns the format tag, or an empty string if the stream is too short to hold one.
+  std::string FormatTag() {
+    char byte_read;
+    while (consumed_.size() != kFormatTagSize) {
+      if (!ReadByte(byte_read))
+        return std::string();
+    }
+    return consumed_;
+  }
+
+  // Parses the fields preceding the cipher text into 'message', which the caller must validate.
+  template<typename Message>
+  bool ReadFields(char cipher_text_field_tag, Message& message, uint64_t& cipher_text_size) {
+    // None of the formats' other fields are anywhere near this size.
+    const size_t kMaxFieldsSize(256);
+    const size_t fields_start(consumed_.size());
+    char field_tag;
+    while (consumed_.size() - fields_start < kMaxFieldsSize) {
+      if (!ReadByte(field_tag))
+        return false;
+      if (field_tag == cipher_text_field_tag) {
+        int fields_size(static_cast<int>(consumed_.size() - fields_start - 1));
+        return message.ParsePartialFromArray(consumed_.data() + fields_start, fields_size) &&
+               ReadVarint(cipher_text_size) && cipher_text_size != 0;
+      }
+      // The formats' other fields are all varints or length-delimited.
+      const int kVarint(0), kLengthDelimited(2);
+      int wire_type(field_tag & 0x07);
+      uint64_t value(0);
+      if ((wire_type != kVarint && wire_type != kLengthDelimited) || !ReadVarint(value))
+        return false;
+      if (wire_type == kVarint)
+        continue;
+      if (value > kMaxFieldsSize)
+        return false;
+      char byte_read;
+      for (uint64_t i(0); i != value; ++i) {
+        if (!ReadByte(byte_read))
+          return false;
+      }
+    }
+    return false;
+  }
+
+  const std::string& consumed() const { return consumed_; }
+
+ private:
+  bool ReadByte(char& byte_read) {
+    if (!source_.get(byte_read))
+      return false;
+    consumed_ += byte_read;
+    return true;
+  }
+
+  bool ReadVarint(uint64_t& value) {
+    value = 0;
+    char byte_read;
+    for (int shift(0); shift < 64; shift += 7) {
+      if (!ReadByte(byte_read))
+        return false;
+      value |= static_cast<uint64_t>(static_cast<unsigned char>(byte_read) & 0x7F) << shift;
+      if ((static_cast<unsigned char>(byte_read) & 0x80) == 0)
+        return true;
+    }
+    return false;
+  }
+
+  std::istream& source_;
+  std::string consumed_;
+};
+
+bool IsValidAuthenticatedSession(const protobuf::AuthenticatedSession& proto_session) {
+  return IsValidKdfPolicy(proto_session.kdf_policy()) &&
+         proto_session.nonce().size() == kNonceSize &&
+         proto_session.key_check().size() == kKeyCheckSize &&
+         proto_session.compression() <= static_cast<uint32_t>(SessionCompression::kDeflate);
+}
+
+bool IsDeflated(const protobuf::AuthenticatedSession& proto_session) {
+  return proto_session.compression() == static_cast<uint32_t>(SessionCompression::kDeflate);
+}
+
+// Returns false if 'data' isn't in the authenticated format.
+bool ParseAuthenticatedSession(const NonEmptyString& data,
+                               protobuf::AuthenticatedSession& proto_session) {
+  const std::string& serialised(data.string());
+  return serialised.compare(0, kFormatTagSize, kAuthenticatedSessionTag) == 0 &&
+         proto_session.ParseFromArray(serialised.data() + kFormatTagSize,
+                                      static_cast<int>(serialised.size() - kFormatTagSize)) &&
+         IsValidAuthenticatedSession(proto_session) &&
+         proto_session.cipher_text().size() > kMacSize;
+}
+
+void SetHmacKey(const SafeString& secure_password, SessionHmac& hmac) {
+  hmac.SetKey(reinterpret_cast<const byte*>(secure_password.data()) + crypto::AES256_KeySize,
+              crypto::AES256_IVSize);
+}
+
+// Starts the HMAC from which the nonce is synthesised.  The plaintext is then added to it.
+void StartNonce(const SafeString& secure_password, bool deflated, SessionHmac& hmac) {
+  SetHmacKey(secure_password, hmac);
+  hmac.Update(deflated ? &kDeflatedNonceDomain : &kNonceDomain, 1);
+}
+
+std::string FinishNonce(SessionHmac& hmac) {
+  std::string nonce(kNonceSize, 0);
+  hmac.TruncatedFinal(reinterpret_cast<byte*>(&nonce[0]), kNonceSize);
+  return nonce;
+}
+
+// Keys an AES-GCM encryptor or decryptor.  A deflated session's compression value is authenticated.
+void SetGcmKey(const SafeString& secure_password,
+               const std::string& nonce,
+               bool deflated,
+               CryptoPP::AuthenticatedSymmetricCipher& cipher) {
+  cipher.SetKeyWithIV(reinterpret_cast<const byte*>(secure_password.data()),
+                      crypto::AES256_KeySize, reinterpret_cast<const byte*>(nonce.data()),
+                      kNonceSize);
+  if (deflated) {
+    byte compression(static_cast<byte>(SessionCompression::kDeflate));
+    cipher.Update(&compression, 1);
+  }
+}
+
+std::string KeyCheck(const SafeString& secure_password) {
+  SessionHmac hmac;
+  SetHmacKey(secure_password, hmac);
+  hmac.Update(&kKeyCheckDomain, 1);
+  std::string key_check(kKeyCheckSize, 0);
+  hmac.TruncatedFinal(reinterpret_cast<byte*>(&key_check[0]), kKeyCheckSize);
+  return key_check;
+}
+
+// Returns the authenticated format's header, excluding the cipher text field's tag and size.
+protobuf::AuthenticatedSession AuthenticatedSessionHeader(const KdfPolicy& kdf_policy,
+                                                          const SafeString& secure_password,
+                                                          const std::string& nonce,
+                                                          bool deflated) {
+  protobuf::AuthenticatedSession proto_session;
+  proto_session.mutable_kdf_policy()->set_version(static_cast<uint32_t>(kdf_policy.version));
+  proto_session.mutable_kdf_policy()->set_iterations(kdf_policy.iterations);
+  proto_session.set_nonce(nonce);
+  proto_session.set_key_check(KeyCheck(secure_password));
+  if (deflated)
+    proto_session.set_compression(static_cast<uint32_t>(SessionCompression::kDeflate));
+  return proto_session;
+}
+
+// Passes everything written to it to a function, for use at the end of a CryptoPP filter chain.
+class FunctionSink : public CryptoPP::Bufferless<CryptoPP::Sink> {
+ public:
+  explicit FunctionSink(std::function<void(const byte*, size_t)> function)
+      : function_(std::move(function)) {}
+  size_t Put2(const byte* data, size_t size, int /*message_end*/, bool /*blocking*/) {
+    if (size != 0)
+      function_(data, size);
+    return 0;
+  }
+
+ private:
+  std::function<void(const byte*, size_t)> function_;
+};
+
+// Returns the deflated session, or an empty string if deflating doesn't make it any smaller.
+std::string Deflate(const std::string& session) {
+  std::string deflated;
+  CryptoPP::Deflator deflator(new CryptoPP::StringSink(deflated), kDeflateLevel);
+  deflator.Put(reinterpret_cast<const byte*>(session.data()), session.size());
+  deflator.MessageEnd();
+  if (deflated.size() >= session.size())
+    deflated.clear();
+  return deflated;
+}
+
+// Since the cipher text has been authenticated before this is called, failure here indicates data
+// written by a faulty implementation rather than tampering, but is reported in the same way.
+std::string Inflate(const std::string& deflated) {
+  std::string session;
+  try {
+    CryptoPP::Inflator inflator(new CryptoPP::StringSink(session));
+    inflator.Put(reinterpret_cast<const byte*>(deflated.data()), deflated.size());
+    inflator.MessageEnd();
+  }
+  catch(const CryptoPP::Exception&) {
+    ThrowError(CommonErrors::symmetric_encryption_error);
+  }
+  if (session.empty())
+    ThrowError(CommonErrors::symmetric_encryption_error);
+  return session;
+}
+
+EncryptedSession EncryptAuthenticatedSession(const KdfPolicy& kdf_policy,
+                                             const SafeString& secure_password,
+                                             const NonEmptyString& serialised_session,
+                                             SessionCompression compression) {
+  std::string deflated;
+  if (compression == SessionCompression::kDeflate)
+    deflated = Deflate(serialised_session.string());
+  bool is_deflated(!deflated.empty());
+  const std::string& plain_text(is_deflated ? deflated : serialised_session.string());
+  SessionHmac hmac;
+  StartNonce(secure_password, is_deflated, hmac);
+  hmac.Update(reinterpret_cast<const byte*>(plain_text.data()), plain_text.size());
+  std::string nonce(FinishNonce(hmac));
+
+  std::string encrypted(CipherTextHeader(kAuthenticatedSessionTag,
+                                         AuthenticatedSessionHeader(kdf_policy, secure_password,
+                                                                    nonce, is_deflated),
+                                         kAuthenticatedSessionFieldTag,
+                                         plain_text.size() + kMacSize));
+  size_t header_size(encrypted.size());
+  encrypted.resize(header_size + plain_text.size() + kMacSize);
+  byte* cipher_text(reinterpret_cast<byte*>(&encrypted[header_size]));
+  CryptoPP::GCM<CryptoPP::AES>::Encryption encryptor;
+  SetGcmKey(secure_password, nonce, is_deflated, encryptor);
+  encryptor.ProcessData(cipher_text, reinterpret_cast<const byte*>(plain_text.data()),
+                        plain_text.size());
+  encryptor.TruncatedFinal(cipher_text + plain_text.size(), kMacSize);
+  return EncryptedSession(NonEmptyString(std::move(encrypted)));
+}
+
+NonEmptyString DecryptAuthenticatedSession(const protobuf::AuthenticatedSession& proto_session,
+                                           const SafeString& secure_password) {
+  if (KeyCheck(secure_password) != proto_session.key_check())
+    ThrowError(CommonErrors::symmetric_encryption_error);
+  const std::string& cipher_text(proto_session.cipher_text());
+  size_t plain_text_size(cipher_text.size() - kMacSize);
+  std::string plain_text(plain_text_size, 0);
+  CryptoPP::GCM<CryptoPP::AES>::Decryption decryptor;
+  SetGcmKey(secure_password, proto_session.nonce(), IsDeflated(proto_session), decryptor);
+  decryptor.ProcessData(reinterpret_cast<byte*>(&plain_text[0]),
+                        reinterpret_cast<const byte*>(cipher_text.data()), plain_text_size);
+  if (!decryptor.TruncatedVerify(
+          reinterpret_cast<const byte*>(cipher_text.data()) + plain_text_size, kMacSize)) {
+    ThrowError(CommonErrors::symmetric_encryption_error);
+  }
+  return NonEmptyString(IsDeflated(proto_session) ? Inflate(plain_text) : std::move(plain_text));
+}
+
+// Reads exactly 'size' bytes from 'source', a chunk at a time, passing each chunk to 'process'.
+template<typename Functor>
+void ForEachChunk(std::istream& source, uint64_t size, SafeString& buffer, Functor process) {
+  while (size != 0) {
+    size_t chunk_size(static_cast<size_t>(std::min(static_cast<uint64_t>(buffer.size()), size)));
+    if (!source.read(&buffer[0], chunk_size))
+      ThrowError(CommonErrors::invalid_parameter);
+    process(reinterpret_cast<byte*>(&buffer[0]), chunk_size);
+    size -= chunk_size;
+  }
+}
+
+// Encrypts in the authenticated format.  The nonce depends on the whole session, so 'source' is
+// read twice: once to compute the nonce, then again to encrypt.  When deflating, the first pass
+// also finds the deflated size, which the header needs, and whether deflating is worthwhile at all;
+// the second pass then deflates again rather than buffering the deflated session.
+void StreamAuthenticatedSession(const KdfPolicy& kdf_policy,
+                                const SafeString& secure_password,
+                                SessionCompression compression,
+                                std::istream& source,
+                                uint64_t size,
+                                std::ostream& sink) {
+  SafeString buffer(kSessionChunkSize, 0);
+  std::istream::pos_type start(source.tellg());
+  SessionHmac hmac, deflated_hmac;
+  StartNonce(secure_password, false, hmac);
+  StartNonce(secure_password, true, deflated_hmac);
+  uint64_t deflated_size(0);
+  std::unique_ptr<CryptoPP::Deflator> deflator;
+  if (compression == SessionCompression::kDeflate) {
+    deflator.reset(new CryptoPP::Deflator(new FunctionSink([&](const byte* data, size_t length) {
+      deflated_hmac.Update(data, length);
+      deflated_size += length;
+    }), kDeflateLevel));
+  }
+  ForEachChunk(source, size, buffer, [&](byte* data, size_t chunk_size) {
+    hmac.Update(data, chunk_size);
+    if (deflator)
+      deflator->Put(data, chunk_size);
+  });
+  if (deflator)
+    deflator->MessageEnd();
+  bool deflated(deflator && deflated_size < size);
+  std::string nonce(FinishNonce(deflated ? deflated_hmac : hmac));
+
+  sink << CipherTextHeader(kAuthenticatedSessionTag,
+                           AuthenticatedSessionHeader(kdf_policy, secure_password, nonce,
+                                                      deflated),
+                           kAuthenticatedSessionFieldTag,
+                           (deflated ? deflated_size : size) + kMacSize);
+  CryptoPP::GCM<CryptoPP::AES>::Encryption encryptor;
+  SetGcmKey(secure_password, nonce, deflated, encryptor);
+  source.seekg(start);
+  if (deflated) {
+    SafeString output(kSessionChunkSize, 0);
+    deflator.reset(new CryptoPP::Deflator(new FunctionSink([&](const byte* data, size_t length) {
+      while (length != 0) {
+        size_t output_size(std::min(length, output.size()));
+        encryptor.ProcessData(reinterpret_cast<byte*>(&output[0]), data, output_size);
+        sink.write(&output[0], output_size);
+        data += output_size;
+        length -= output_size;
+      }
+    }), kDeflateLevel));
+    ForEachChunk(source, size, buffer, [&](byte* data, size_t chunk_size) {
+      deflator->Put(data, chunk_size);
+    });
+    deflator->MessageEnd();
+  } else {
+    ForEachChunk(source, size, buffer, [&](byte* data, size_t chunk_size) {
+      encryptor.ProcessData(data, data, chunk_size);
+      sink.write(reinterpret_cast<const char*>(data), chunk_size);
+    });
+  }
+  byte mac[kMacSize];
+  encryptor.TruncatedFinal(mac, kMacSize);
+  sink.write(reinterpret_cast<const char*>(mac), kMacSize);
+  if (!sink)
+    ThrowError(CommonErrors::symmetric_encryption_error);
+}
+
+// Decrypts the cipher text of the authenticated format, which must follow in 'source'.  Since the
+// MAC follows the cipher text, the plaintext has been written to 'sink' by the time this throws for
+// a failed authentication.
+void StreamAuthenticatedSession(const protobuf::AuthenticatedSession& proto_session,
+                                const SafeString& secure_password,
+                                std::istream& source,
+                                uint64_t cipher_text_size,
+                                std::ostream& sink) {
+  if (cipher_text_size <= kMacSize || KeyCheck(secure_password) != proto_session.key_check())
+    ThrowError(CommonErrors::symmetric_encryption_error);
+  SafeString buffer(kSessionChunkSize, 0);
+  CryptoPP::GCM<CryptoPP::AES>::Decryption decryptor;
+  SetGcmKey(secure_password, proto_session.nonce(), IsDeflated(proto_session), decryptor);
+  auto write_plain_text([&sink](const byte* data, size_t size) {
+    sink.write(reinterpret_cast<const char*>(data), size);
+  });
+  std::unique_ptr<CryptoPP::Inflator> inflator;
+  if (IsDeflated(proto_session))
+    inflator.reset(new CryptoPP::Inflator(new FunctionSink(write_plain_text)));
+  try {
+    ForEachChunk(source, cipher_text_size - kMacSize, buffer, [&](byte* data, size_t chunk_size) {
+      decryptor.ProcessData(data, data, chunk_size);
+      if (inflator)
+        inflator->Put(data, chunk_size);
+      else
+        write_plain_text(data, chunk_size);
+    });
+    if (inflator)
+      inflator->MessageEnd();
+  }
+  catch(const CryptoPP::Exception&) {
+    ThrowError(CommonErrors::symmetric_encryption_error);
+  }
+  byte mac[kMacSize];
+  if (!source.read(reinterpret_cast<char*>(mac), kMacSize) ||
+      !decryptor.TruncatedVerify(mac, kMacSize) || !sink) {
+    ThrowError(CommonErrors::symmetric_encryption_error);
+  }
+}
+
+// Applies the session obfuscation of XorData and the AES-CFB encryption of crypto::SymmEncrypt (or
+// their reversal when decrypting) to 'prefix' followed by the next 'size' bytes of 'source', or all
+// of its remainder if 'size' is kUnboundedSessionSize, writing the result to 'sink'.  This handles
+// the unversioned and protobuf::VersionedCipherText formats.  Throws if 'source' ends early.
+template<typename Cipher>
+void StreamSession(const std::pair<SafeString, SafeString>& session_keys,
+                   const std::string& prefix,
+                   std::istream& source,
+                   uint64_t size,
+                   std::ostream& sink) {
+  const bool kEncrypt(std::is_same<Cipher, CryptoPP::CFB_Mode<CryptoPP::AES>::Encryption>::value);
+  const SafeString& secure_password(session_keys.first);
+  const SafeString& obfuscation_key(session_keys.second);
+  Cipher cipher(reinterpret_cast<const byte*>(secure_password.data()), crypto::AES256_KeySize,
+                reinterpret_cast<const byte*>(secure_password.data()) + crypto::AES256_KeySize);
+  SafeString buffer(std::max(kSessionChunkSize, prefix.size()), 0);
+  size_t key_offset(0);
+  auto process([&](size_t size) {
+    byte* data(reinterpret_cast<byte*>(&buffer[0]));
+    if (!kEncrypt)
+      cipher.ProcessData(data, data, size);
+    key_offset = ApplyObfuscation(obfuscation_key, key_offset, data, size);
+    if (kEncrypt)
+      cipher.ProcessData(data, data, size);
+    sink.write(buffer.data(), size);
+  });
+
+  std::copy(prefix.begin(), prefix.end(), buffer.begin());
+  size_t buffered(prefix.size()), total(0);
+  uint64_t remaining(size);
+  // The first pass always runs, since reading the prefix may already have exhausted 'source'.
+  do {
+    size_t to_read(static_cast<size_t>(
+        std::min(static_cast<uint64_t>(buffer.size() - buffered), remaining)));
+    source.read(&buffer[buffered], to_read);
+    buffered += static_cast<size_t>(source.gcount());
+    if (size != kUnboundedSessionSize)
+      remaining -= static_cast<uint64_t>(source.gcount());
+    if (buffered == 0)
+      break;
+    process(buffered);
+    total += buffered;
+    buffered = 0;
+  } while (source && remaining != 0);
+  if (total == 0)
+    ThrowError(CommonErrors::invalid_parameter);
+  if ((size != kUnboundedSessionSize && remaining != 0) || source.bad() || !sink)
+    ThrowError(CommonErrors::symmetric_encryption_error);
+}
+
+KdfPolicy KdfPolicyOf(const NonEmptyString& data) {
+  protobuf::AuthenticatedSession proto_session;
+  if (ParseAuthenticatedSession(data, proto_session))
+    return KdfPolicy(proto_session.kdf_policy().iterations());
+  KdfPolicy kdf_policy(KdfPolicy::PinScaled());
+  crypto::CipherText cipher_text;
+  UnwrapCipherText(data, kdf_policy, cipher_text);
+  return kdf_policy;
+}
+
+NonEmptyString XorData(const SafeString& obfuscation_key, const NonEmptyString& data) {
+  std::string obfuscated(data.string());
+  ApplyObfuscation(obfuscation_key, 0, reinterpret_cast<byte*>(&obfuscated[0]), obfuscated.size());
+  return NonEmptyString(std::move(obfuscated));
+}
+
+template<typename Packet, typename PublicKey, typename Check>
+std::vector<bool> ValidateInParallel(const std::vector<Packet>& packets,
+                                     const std::vector<PublicKey>& public_keys,
+                                     Check check) {
+  if (packets.size() != public_keys.size())
+    ThrowError(CommonErrors::invalid_parameter);
+  // Use the first copy of each distinct key for all its packets, so its verifier is built only
+  // once.  Keys are identified by their encoding rather than by the name they claim, which isn't
+  // checked.
+  std::map<std::string, const PublicKey*> distinct_keys;
+  std::vector<const PublicKey*> verifiers;
+  verifiers.reserve(public_keys.size());
+  for (const auto& public_key : public_keys) {
+    auto inserted(distinct_keys.insert(std::make_pair(
+        PublicKey::scheme_type::EncodeKey(public_key.public_key()).string(), &public_key)));
+    verifiers.push_back(inserted.first->second);
+  }
+
+  auto check_range = [&](size_t begin, size_t end)->std::vector<bool> {
+    std::vector<bool> results;
+    results.reserve(end - begin);
+    for (size_t i(begin); i != end; ++i) {
+      try {
+        results.push_back(check(packets[i], *verifiers[i]));
+      }
+      catch(const std::exception&) {
+        results.push_back(false);
+      }
+    }
+    return results;
+  };
+  size_t thread_count(std::min(static_cast<size_t>(std::thread::hardware_concurrency()),
+                               packets.size() / kMinPacketsPerThread));
+  if (thread_count < 2)
+    return check_range(0, packets.size());
+
+  size_t range_size((packets.size() + thread_count - 1) / thread_count);
+  std::vector<std::future<std::vector<bool>>> ranges;
+  for (size_t begin(0); begin < packets.size(); begin += range_size) {
+    ranges.push_back(std::async(std::launch::async, check_range, begin,
+                                std::min(begin + range_size, packets.size())));
+  }
+  std::vector<bool> results;
+  results.reserve(packets.size());
+  for (auto& range : ranges) {
+    auto range_results(range.get());
+    results.insert(results.end(), range_results.begin(), range_results.end());
+  }
+  return results;
+}
+
+template<typename Tag, typename PublicKey>
+std::vector<bool> ValidateMids(const std::vector<MidData<Tag>>& packets,
+                               const std::vector<PublicKey>& public_keys) {
+  return ValidateInParallel(packets, public_keys,
+      [](const MidData<Tag>& mid, const PublicKey& public_key) {
+        return public_key.Verify(mid.encrypted_tmid_name().data, mid.validation_token());
+      });
 }
 
 }  // unnamed namespace
@@ -102,6 +795,52 @@ NonEmptyString MidToProtobuf(DataTagValue enum_value,
   return NonEmptyString(proto_mid.SerializeAsString());
 }
 
+void IdentityPacketView(const NonEmptyString& serialised_packet,
+                        DataTagValue enum_value,
+                        PassportErrors error,
+                        boost::string_ref& payload,
+                        boost::string_ref& validation_token) {
+  typedef google::protobuf::internal::WireFormatLite WireFormat;
+  // Field numbers of both protobuf::Mid and protobuf::Tmid
+  static const uint32_t kTypeTag(WireFormat::MakeTag(1, WireFormat::WIRETYPE_VARINT));
+  static const uint32_t kPayloadTag(WireFormat::MakeTag(2, WireFormat::WIRETYPE_LENGTH_DELIMITED));
+  static const uint32_t kTokenTag(WireFormat::MakeTag(3, WireFormat::WIRETYPE_LENGTH_DELIMITED));
+
+  const std::string& buffer(serialised_packet.string());
+  google::protobuf::io::CodedInputStream input(reinterpret_cast<const uint8_t*>(buffer.data()),
+                                               static_cast<int>(buffer.size()));
+  // As for the generated parser, the last occurrence of a field wins and unknown fields are skipped
+  auto read_bytes = [&](boost::string_ref& field)->bool {
+    uint32_t size(0);
+    if (!input.ReadVarint32(&size))
+      return false;
+    int offset(input.CurrentPosition());
+    if (!input.Skip(static_cast<int>(size)))
+      return false;
+    field = boost::string_ref(buffer.data() + offset, size);
+    return true;
+  };
+  bool has_type(false), has_payload(false), has_token(false);
+  uint32_t type(0);
+  for (uint32_t tag(input.ReadTag()); tag != 0; tag = input.ReadTag()) {
+    bool parsed(false);
+    if (tag == kTypeTag)
+      parsed = has_type = input.ReadVarint32(&type);
+    else if (tag == kPayloadTag)
+      parsed = has_payload = read_bytes(payload);
+    else if (tag == kTokenTag)
+      parsed = has_token = read_bytes(validation_token);
+    else if (WireFormat::GetTagWireType(tag) != WireFormat::WIRETYPE_END_GROUP)
+      parsed = WireFormat::SkipField(&input, tag);
+    if (!parsed)
+      ThrowError(error);
+  }
+  if (!input.ConsumedEntireMessage() || !has_type || !has_payload || !has_token ||
+      payload.empty() || validation_token.empty() || static_cast<uint32_t>(enum_value) != type) {
+    ThrowError(error);
+  }
+}
+
 
 template<>
 SecureString::Hash GenerateMidName<MidData<MidTag>>(const Keyword& keyword,  // NOLINT (Fraser)
@@ -124,6 +863,46 @@ crypto::SHA512Hash HashOfPin(uint32_t pin) {
 }
 
 
+const uint32_t KdfPolicy::kDefaultIterations;
+const uint32_t KdfPolicy::kMinimumIterations;
+
+KdfPolicy::KdfPolicy() : version(Version::kFixed), iterations(kDefaultIterations) {}
+
+KdfPolicy::KdfPolicy(uint32_t iterations_in) : version(Version::kFixed), iterations(iterations_in) {
+  if (iterations < kMinimumIterations)
+    ThrowError(CommonErrors::invalid_parameter);
+}
+
+KdfPolicy KdfPolicy::PinScaled() {
+  KdfPolicy kdf_policy;
+  kdf_policy.version = Version::kPinScaled;
+  kdf_policy.iterations = 0;
+  return kdf_policy;
+}
+
+bool operator==(const KdfPolicy& lhs, const KdfPolicy& rhs) {
+  return lhs.version == rhs.version && lhs.iterations == rhs.iterations;
+}
+
+bool operator!=(const KdfPolicy& lhs, const KdfPolicy& rhs) {
+  return !(lhs == rhs);
+}
+
+KdfPolicy CalibrateKdfPolicy(std::chrono::milliseconds target_latency) {
+  // When given a duration, PBKDF2 keeps iterating until it has elapsed and reports the iterations.
+  SafeString password(RandomSafeString<SafeString>(64));
+  std::string salt(RandomString(crypto::SHA512::DIGESTSIZE));
+  SafeString derived(crypto::AES256_KeySize + crypto::AES256_IVSize, 0);
+  CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA512> pbkdf;
+  uint32_t iterations(pbkdf.DeriveKey(reinterpret_cast<byte*>(&derived[0]), derived.size(), 0,
+                                      reinterpret_cast<const byte*>(password.data()),
+                                      password.size(),
+                                      reinterpret_cast<const byte*>(salt.data()), salt.size(), 1,
+                                      target_latency.count() / 1000.0));
+  return KdfPolicy(std::max(iterations, KdfPolicy::kMinimumIterations));
+}
+
+
 TmidData::TmidData(const TmidData& other)
     : name_(other.name_),
       encrypted_session_(other.encrypted_session_),
@@ -149,9 +928,15 @@ TmidData& TmidData::operator=(TmidData&& other) {
 }
 
 TmidData::TmidData(const EncryptedSession& encrypted_session, const signer_type& signing_fob)
-    : name_(crypto::Hash<crypto::SHA512>(encrypted_session.data)),
+    : name_(),
       encrypted_session_(encrypted_session),
-      validation_token_(asymm::Sign(encrypted_session.data, signing_fob.private_key())) {}
+      validation_token_() {
+  // The name is the SHA-512 hash of the session, which is also the hash signed, so both are taken
+  // from a single pass over the session.
+  crypto::SHA512Hash digest;
+  validation_token_ = signing_fob.Sign(encrypted_session.data, digest);
+  name_ = Name(Identity(digest.string()));
+}
 
 TmidData::TmidData(Name name, const serialised_type& serialised_tmid)
     : name_(std::move(name)), encrypted_session_(), validation_token_() {
@@ -173,44 +958,332 @@ TmidData::serialised_type TmidData::Serialise() const {
 }
 
 
+TmidDataView::TmidDataView(Name name, const serialised_type& serialised_tmid)
+    : name_(std::move(name)),
+      encrypted_session_(),
+      validation_token_() {
+  IdentityPacketView(serialised_tmid.data, TmidTag::kValue, PassportErrors::tmid_parsing_error,
+                     encrypted_session_, validation_token_);
+}
+
+bool ValidateTmid(const TmidData& tmid, const PublicFob<AntmidTag>& public_antmid) {
+  crypto::SHA512Hash digest;
+  bool valid_signature(public_antmid.Verify(tmid.encrypted_session().data,
+                                            tmid.validation_token(), digest));
+  return valid_signature && tmid.name() == TmidData::Name(Identity(digest.string()));
+}
+
+std::vector<bool> ValidatePackets(const std::vector<MidData<MidTag>>& packets,
+                                  const std::vector<PublicFob<AnmidTag>>& public_keys) {
+  return ValidateMids(packets, public_keys);
+}
+
+std::vector<bool> ValidatePackets(const std::vector<MidData<SmidTag>>& packets,
+                                  const std::vector<PublicFob<AnsmidTag>>& public_keys) {
+  return ValidateMids(packets, public_keys);
+}
+
+std::vector<bool> ValidatePackets(const std::vector<TmidData>& packets,
+                                  const std::vector<PublicFob<AntmidTag>>& public_keys) {
+  return ValidateInParallel(packets, public_keys, ValidateTmid);
+}
+
+
 EncryptedSession EncryptSession(const Keyword& keyword,
                                 const Pin& pin,
                                 const Password& password,
-                                const NonEmptyString& serialised_session) {
-  crypto::SecurePassword secure_password(CreateSecureTmidPassword(password, pin));
-  return EncryptedSession(
-      crypto::SymmEncrypt(XorData(keyword, pin, password, serialised_session),
-                          SecureKey(secure_password),
-                          SecureIv(secure_password)));
+                                const NonEmptyString& serialised_session,
+                                const KdfPolicy& kdf_policy) {
+  return LoginContext(keyword, pin, password, kdf_policy).EncryptSession(serialised_session);
 }
 
 NonEmptyString DecryptSession(const Keyword& keyword,
                               const Pin& pin,
                               const Password& password,
                               const EncryptedSession& encrypted_session) {
-  crypto::SecurePassword secure_password(CreateSecureTmidPassword(password, pin));
-  return XorData(keyword, pin, password,
-                 crypto::SymmDecrypt(encrypted_session.data,
-                                     SecureKey(secure_password),
-                                     SecureIv(secure_password)));
+  return LoginContext(keyword, pin, password).DecryptSession(encrypted_session);
 }
 
 EncryptedTmidName EncryptTmidName(const Keyword& keyword,
                                   const Pin& pin,
-                                  const TmidData::Name& tmid_name) {
-  crypto::SecurePassword secure_password(CreateSecureMidPassword(keyword, pin));
-  return EncryptedTmidName(crypto::SymmEncrypt(crypto::PlainText(tmid_name.value),
-                                               SecureKey(secure_password),
-                                               SecureIv(secure_password)));
+                                  const TmidData::Name& tmid_name,
+                                  const KdfPolicy& kdf_policy) {
+  return LoginContext(keyword, pin, kdf_policy).EncryptTmidName(tmid_name);
 }
 
 TmidData::Name DecryptTmidName(const Keyword& keyword,
                                const Pin& pin,
                                const EncryptedTmidName& encrypted_tmid_name) {
-  crypto::SecurePassword secure_password(CreateSecureMidPassword(keyword, pin));
-  return TmidData::Name(Identity(crypto::SymmDecrypt(encrypted_tmid_name.data,
-                                                     SecureKey(secure_password),
-                                                     SecureIv(secure_password)).string()));
+  return LoginContext(keyword, pin).DecryptTmidName(encrypted_tmid_name);
+}
+
+void EncryptSession(const Keyword& keyword,
+                    const Pin& pin,
+                    const Password& password,
+                    std::istream& source,
+                    std::ostream& sink,
+                    const KdfPolicy& kdf_policy) {
+  LoginContext(keyword, pin, password, kdf_policy).EncryptSession(source, sink);
+}
+
+void DecryptSession(const Keyword& keyword,
+                    const Pin& pin,
+                    const Password& password,
+                    std::istream& source,
+                    std::ostream& sink) {
+  LoginContext(keyword, pin, password).DecryptSession(source, sink);
+}
+
+KdfPolicy GetKdfPolicy(const EncryptedSession& encrypted_session) {
+  return KdfPolicyOf(encrypted_session.data);
+}
+
+KdfPolicy GetKdfPolicy(const EncryptedTmidName& encrypted_tmid_name) {
+  return KdfPolicyOf(encrypted_tmid_name.data);
+}
+
+
+LoginContext::LoginContext(const Keyword& keyword, const Pin& pin, const KdfPolicy& kdf_policy)
+    : keyword_(keyword.string()),
+      pin_(pin.string()),
+      password_(),
+      pin_value_(PinValue(pin_)),
+      kdf_policy_(kdf_policy),
+      pin_hash_(crypto::Hash<crypto::SHA512>(pin_)),
+      mid_name_hash_(crypto::Hash<crypto::SHA512>(
+          crypto::Hash<crypto::SHA512>(keyword_).string() + pin_hash_.string())),
+      secure_mid_password_(),
+      secure_tmid_password_(),
+      obfuscation_key_(),
+      secure_mid_password_flag_(),
+      secure_tmid_password_flag_(),
+      obfuscation_key_flag_(),
+      session_keys_flag_() {}
+
+LoginContext::LoginContext(const Keyword& keyword, const Pin& pin, const Password& password,
+                           const KdfPolicy& kdf_policy)
+    : keyword_(keyword.string()),
+      pin_(pin.string()),
+      password_(password.string()),
+      pin_value_(PinValue(pin_)),
+      kdf_policy_(kdf_policy),
+      pin_hash_(crypto::Hash<crypto::SHA512>(pin_)),
+      mid_name_hash_(crypto::Hash<crypto::SHA512>(
+          crypto::Hash<crypto::SHA512>(keyword_).string() + pin_hash_.string())),
+      secure_mid_password_(),
+      secure_tmid_password_(),
+      obfuscation_key_(),
+      secure_mid_password_flag_(),
+      secure_tmid_password_flag_(),
+      obfuscation_key_flag_(),
+      session_keys_flag_() {}
+
+MidData<MidTag>::Name LoginContext::MidName() const {
+  return MidData<MidTag>::Name(
+      Identity(std::string(mid_name_hash_.string().begin(), mid_name_hash_.string().end())));
+}
+
+MidData<SmidTag>::Name LoginContext::SmidName() const {
+  SecureString::Hash smid_name_hash(crypto::Hash<crypto::SHA512>(mid_name_hash_.string()));
+  return MidData<SmidTag>::Name(
+      Identity(std::string(smid_name_hash.string().begin(), smid_name_hash.string().end())));
+}
+
+EncryptedTmidName LoginContext::EncryptTmidName(const TmidData::Name& tmid_name) const {
+  const SafeString& secure_password(SecureMidPassword());
+  return EncryptedTmidName(WrapCipherText(kdf_policy_,
+                                          crypto::SymmEncrypt(crypto::PlainText(tmid_name.value),
+                                                              SecureKey(secure_password),
+                                                              SecureIv(secure_password))));
+}
+
+TmidData::Name LoginContext::DecryptTmidName(
+    const EncryptedTmidName& encrypted_tmid_name) const {
+  auto decrypt([this](const KdfPolicy& kdf_policy, const crypto::CipherText& cipher_text) {
+    SafeString secure_password(SecureMidPassword(kdf_policy));
+    return TmidData::Name(Identity(crypto::SymmDecrypt(cipher_text, SecureKey(secure_password),
+                                                       SecureIv(secure_password)).string()));
+  });
+  KdfPolicy kdf_policy;
+  crypto::CipherText cipher_text;
+  if (UnwrapCipherText(encrypted_tmid_name.data, kdf_policy, cipher_text)) {
+    try {
+      return decrypt(kdf_policy, cipher_text);
+    }
+    catch(const std::exception&) {
+      // This may be unversioned data which happens to begin with the versioned format's tag.
+    }
+  }
+  return decrypt(KdfPolicy::PinScaled(), encrypted_tmid_name.data);
+}
+
+EncryptedSession LoginContext::EncryptSession(const NonEmptyString& serialised_session,
+                                              SessionCompression compression) const {
+  if (kdf_policy_.version != KdfPolicy::Version::kPinScaled)
+    return EncryptAuthenticatedSession(kdf_policy_, SecureTmidPassword(), serialised_session,
+                                       compression);
+  auto session_keys(SessionKeys(kdf_policy_));
+  return EncryptedSession(crypto::SymmEncrypt(XorData(session_keys.second, serialised_session),
+                                              SecureKey(session_keys.first),
+                                              SecureIv(session_keys.first)));
+}
+
+NonEmptyString LoginContext::DecryptSession(const EncryptedSession& encrypted_session) const {
+  protobuf::AuthenticatedSession proto_session;
+  if (ParseAuthenticatedSession(encrypted_session.data, proto_session)) {
+    return DecryptAuthenticatedSession(
+        proto_session, SecureTmidPassword(KdfPolicy(proto_session.kdf_policy().iterations())));
+  }
+
+  auto decrypt([this](const KdfPolicy& kdf_policy, const crypto::CipherText& cipher_text) {
+    auto session_keys(SessionKeys(kdf_policy));
+    return XorData(session_keys.second, crypto::SymmDecrypt(cipher_text,
+                                                            SecureKey(session_keys.first),
+                                                            SecureIv(session_keys.first)));
+  });
+  KdfPolicy kdf_policy;
+  crypto::CipherText cipher_text;
+  if (UnwrapCipherText(encrypted_session.data, kdf_policy, cipher_text)) {
+    try {
+      return decrypt(kdf_policy, cipher_text);
+    }
+    catch(const std::exception&) {
+      // This may be unversioned data which happens to begin with the versioned format's tag.
+    }
+  }
+  return decrypt(KdfPolicy::PinScaled(), encrypted_session.data);
+}
+
+void LoginContext::EncryptSession(std::istream& source,
+                                  std::ostream& sink,
+                                  SessionCompression compression) const {
+  if (kdf_policy_.version == KdfPolicy::Version::kPinScaled) {
+    StreamSession<CryptoPP::CFB_Mode<CryptoPP::AES>::Encryption>(
+        SessionKeys(kdf_policy_), std::string(), source, kUnboundedSessionSize, sink);
+    return;
+  }
+  // Only the authenticated format needs the size up front, so only it requires a seekable source.
+  std::istream::pos_type start(source.tellg());
+  source.seekg(0, std::ios::end);
+  std::istream::pos_type end(source.tellg());
+  source.seekg(start);
+  if (start == std::istream::pos_type(-1) || end == std::istream::pos_type(-1) || end <= start)
+    ThrowError(CommonErrors::invalid_parameter);
+  StreamAuthenticatedSession(kdf_policy_, SecureTmidPassword(), compression, source,
+                             static_cast<uint64_t>(end - start), sink);
+}
+
+void LoginContext::DecryptSession(std::istream& source, std::ostream& sink) const {
+  // Unlike the non-streaming version, this can't retry as unversioned data once it has started
+  // writing to 'sink', so the format is determined from the header alone.
+  CipherTextHeaderReader header_reader(source);
+  std::string format_tag(header_reader.FormatTag());
+  uint64_t cipher_text_size(0);
+  if (format_tag == kAuthenticatedSessionTag) {
+    protobuf::AuthenticatedSession proto_session;
+    if (header_reader.ReadFields(kAuthenticatedSessionFieldTag, proto_session, cipher_text_size) &&
+        IsValidAuthenticatedSession(proto_session)) {
+      StreamAuthenticatedSession(
+          proto_session, SecureTmidPassword(KdfPolicy(proto_session.kdf_policy().iterations())),
+          source, cipher_text_size, sink);
+      return;
+    }
+  } else if (format_tag == kVersionedCipherTextTag) {
+    protobuf::VersionedCipherText proto_cipher_text;
+    if (header_reader.ReadFields(kVersionedCipherTextFieldTag, proto_cipher_text,
+                                 cipher_text_size) &&
+        IsValidKdfPolicy(proto_cipher_text.kdf_policy())) {
+      StreamSession<CryptoPP::CFB_Mode<CryptoPP::AES>::Decryption>(
+          SessionKeys(KdfPolicy(proto_cipher_text.kdf_policy().iterations())), std::string(),
+          source, cipher_text_size, sink);
+      return;
+    }
+  }
+  StreamSession<CryptoPP::CFB_Mode<CryptoPP::AES>::Decryption>(
+      SessionKeys(KdfPolicy::PinScaled()), header_reader.consumed(), source, kUnboundedSessionSize,
+      sink);
+}
+
+void LoginContext::DeriveKeys() const {
+  std::vector<std::future<void>> derivations;
+  derivations.push_back(std::async(std::launch::async, [this] { SecureMidPassword(); }));
+  if (!password_.empty()) {
+    derivations.push_back(std::async(std::launch::async, [this] { SecureTmidPassword(); }));
+    // Only the unversioned format still needs the obfuscation key when writing sessions.
+    if (kdf_policy_.version == KdfPolicy::Version::kPinScaled)
+      derivations.push_back(std::async(std::launch::async, [this] { ObfuscationKey(); }));
+  }
+  for (auto& derivation : derivations)
+    derivation.get();
+}
+
+const SafeString& LoginContext::SecureMidPassword() const {
+  std::call_once(secure_mid_password_flag_, [this] {
+    secure_mid_password_ = CreateSecureMidPassword(keyword_, pin_, pin_value_, kdf_policy_);
+  });
+  return secure_mid_password_;
+}
+
+const SafeString& LoginContext::SecureTmidPassword() const {
+  if (password_.empty())
+    ThrowError(CommonErrors::uninitialised);
+  std::call_once(secure_tmid_password_flag_, [this] {
+    secure_tmid_password_ =
+        CreateSecureTmidPassword(password_, pin_hash_, pin_value_, kdf_policy_);
+  });
+  return secure_tmid_password_;
+}
+
+const SafeString& LoginContext::ObfuscationKey() const {
+  if (password_.empty())
+    ThrowError(CommonErrors::uninitialised);
+  std::call_once(obfuscation_key_flag_, [this] {
+    obfuscation_key_ =
+        CreateObfuscationKey(keyword_, password_, pin_hash_, pin_value_, kdf_policy_);
+  });
+  return obfuscation_key_;
+}
+
+// The session is protected by both the Tmid password and the obfuscation key, so these are derived
+// concurrently, each on its own thread.
+void LoginContext::DeriveSessionKeys() const {
+  if (password_.empty())
+    ThrowError(CommonErrors::uninitialised);
+  std::call_once(session_keys_flag_, [this] {
+    auto obfuscation_key(std::async(std::launch::async, [this] { ObfuscationKey(); }));
+    SecureTmidPassword();
+    obfuscation_key.get();
+  });
+}
+
+SafeString LoginContext::SecureMidPassword(const KdfPolicy& kdf_policy) const {
+  if (kdf_policy == kdf_policy_)
+    return SecureMidPassword();
+  return CreateSecureMidPassword(keyword_, pin_, pin_value_, kdf_policy);
+}
+
+SafeString LoginContext::SecureTmidPassword(const KdfPolicy& kdf_policy) const {
+  if (kdf_policy == kdf_policy_)
+    return SecureTmidPassword();
+  if (password_.empty())
+    ThrowError(CommonErrors::uninitialised);
+  return CreateSecureTmidPassword(password_, pin_hash_, pin_value_, kdf_policy);
+}
+
+// Returns the Tmid password and obfuscation key, in that order.
+std::pair<SafeString, SafeString> LoginContext::SessionKeys(const KdfPolicy& kdf_policy) const {
+  if (kdf_policy == kdf_policy_) {
+    DeriveSessionKeys();
+    return std::make_pair(SecureTmidPassword(), ObfuscationKey());
+  }
+  if (password_.empty())
+    ThrowError(CommonErrors::uninitialised);
+  auto obfuscation_key(std::async(std::launch::async, [&] {
+    return CreateObfuscationKey(keyword_, password_, pin_hash_, pin_value_, kdf_policy);
+  }));
+  SafeString secure_tmid_password(
+      CreateSecureTmidPassword(password_, pin_hash_, pin_value_, kdf_policy));
+  return std::make_pair(secure_tmid_password, obfuscation_key.get());
 }
 
 #ifdef TESTING
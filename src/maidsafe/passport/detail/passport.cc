@@ -68,6 +68,45 @@ Tmid::Name DecryptTmidName(const detail::Keyword& keyword,
   return detail::DecryptTmidName(keyword, pin, encrypted_tmid_name);
 }
 
+EncryptedSession EncryptSession(const LoginContext& login_context,
+                                const NonEmptyString& serialised_session,
+                                SessionCompression compression) {
+  return login_context.EncryptSession(serialised_session, compression);
+}
+
+NonEmptyString DecryptSession(const LoginContext& login_context,
+                              const EncryptedSession& encrypted_session) {
+  return login_context.DecryptSession(encrypted_session);
+}
+
+EncryptedTmidName EncryptTmidName(const LoginContext& login_context, const Tmid::Name& tmid_name) {
+  return login_context.EncryptTmidName(tmid_name);
+}
+
+Tmid::Name DecryptTmidName(const LoginContext& login_context,
+                           const EncryptedTmidName& encrypted_tmid_name) {
+  return login_context.DecryptTmidName(encrypted_tmid_name);
+}
+
+Mid::Name MidName(const LoginContext& login_context) {
+  return login_context.MidName();
+}
+
+Smid::Name SmidName(const LoginContext& login_context) {
+  return login_context.SmidName();
+}
+
+void EncryptSession(const LoginContext& login_context,
+                    std::istream& source,
+                    std::ostream& sink,
+                    SessionCompression compression) {
+  login_context.EncryptSession(source, sink, compression);
+}
+
+void DecryptSession(const LoginContext& login_context, std::istream& source, std::ostream& sink) {
+  login_context.DecryptSession(source, sink);
+}
+
 NonEmptyString SerialisePmid(const Pmid& pmid) {
   return detail::SerialisePmid(pmid);
 }
@@ -26,29 +26,65 @@ namespace maidsafe {
 namespace passport {
 namespace detail {
 
-void PublicFobFromProtobuf(const NonEmptyString& serialised_public_fob,
-                           DataTagValue enum_value,
-                           asymm::PublicKey& public_key,
-                           asymm::Signature& validation_token) {
+namespace {
+
+template<typename Scheme>
+void ParsePublicFob(const NonEmptyString& serialised_public_fob,
+                    DataTagValue enum_value,
+                    typename Scheme::PublicKey& public_key,
+                    asymm::Signature& validation_token) {
   protobuf::PublicFob proto_public_fob;
-  if (!proto_public_fob.ParseFromString(serialised_public_fob.string()))
+  if (!proto_public_fob.ParseFromString(serialised_public_fob.string()) ||
+      proto_public_fob.signature_scheme() != static_cast<uint32_t>(Scheme::kId)) {
     ThrowError(PassportErrors::fob_parsing_error);
+  }
   validation_token = asymm::Signature(proto_public_fob.validation_token());
-  public_key = asymm::DecodeKey(asymm::EncodedPublicKey(proto_public_fob.encoded_public_key()));
+  public_key = Scheme::DecodePublicKey(NonEmptyString(proto_public_fob.encoded_public_key()));
   if (static_cast<uint32_t>(enum_value) != proto_public_fob.type())
     ThrowError(PassportErrors::fob_parsing_error);
 }
 
-NonEmptyString PublicFobToProtobuf(DataTagValue enum_value,
-                                   const asymm::PublicKey& public_key,
-                                   const asymm::Signature& validation_token) {
+template<typename Scheme>
+NonEmptyString SerialisePublicFob(DataTagValue enum_value,
+                                  const typename Scheme::PublicKey& public_key,
+                                  const asymm::Signature& validation_token) {
   protobuf::PublicFob proto_public_fob;
   proto_public_fob.set_type(static_cast<uint32_t>(enum_value));
-  proto_public_fob.set_encoded_public_key(asymm::EncodeKey(public_key).string());
+  proto_public_fob.set_encoded_public_key(Scheme::EncodeKey(public_key).string());
   proto_public_fob.set_validation_token(validation_token.string());
+  if (Scheme::kId != SignatureSchemeId::kRsa)
+    proto_public_fob.set_signature_scheme(static_cast<uint32_t>(Scheme::kId));
   return NonEmptyString(proto_public_fob.SerializeAsString());
 }
 
+}  // unnamed namespace
+
+void PublicFobFromProtobuf(const NonEmptyString& serialised_public_fob,
+                           DataTagValue enum_value,
+                           RsaScheme::PublicKey& public_key,
+                           asymm::Signature& validation_token) {
+  ParsePublicFob<RsaScheme>(serialised_public_fob, enum_value, public_key, validation_token);
+}
+
+void PublicFobFromProtobuf(const NonEmptyString& serialised_public_fob,
+                           DataTagValue enum_value,
+                           EcdsaScheme::PublicKey& public_key,
+                           asymm::Signature& validation_token) {
+  ParsePublicFob<EcdsaScheme>(serialised_public_fob, enum_value, public_key, validation_token);
+}
+
+NonEmptyString PublicFobToProtobuf(DataTagValue enum_value,
+                                   const RsaScheme::PublicKey& public_key,
+                                   const asymm::Signature& validation_token) {
+  return SerialisePublicFob<RsaScheme>(enum_value, public_key, validation_token);
+}
+
+NonEmptyString PublicFobToProtobuf(DataTagValue enum_value,
+                                   const EcdsaScheme::PublicKey& public_key,
+                                   const asymm::Signature& validation_token) {
+  return SerialisePublicFob<EcdsaScheme>(enum_value, public_key, validation_token);
+}
+
 }  // namespace detail
 }  // namespace passport
 }  // namespace maidsafe
@@ -18,6 +18,16 @@
 
 #include "maidsafe/passport/detail/secure_string.h"
 
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <utility>
+
+#include "boost/thread/tss.hpp"
+
+#include "maidsafe/common/error.h"
+
 namespace maidsafe {
 namespace passport {
 namespace detail {
@@ -25,7 +35,7 @@ namespace detail {
 SecureString::SecureString()
   : phrase_(RandomSafeString<SafeString>(64)),
     string_(),
-    encryptor_(new Encryptor(phrase_.data(), new Encoder(new Sink(string_)))) {}
+    encryptor_(new Encryptor(phrase_.data(), new Sink(string_))) {}
 
 SecureString::~SecureString() {}
 
@@ -39,17 +49,165 @@ void SecureString::Finalise() {
 
 void SecureString::Clear() {
   string_.clear();
-  encryptor_.reset(new Encryptor(phrase_.data(), new Encoder(new Sink(string_))));
+  encryptor_.reset(new Encryptor(phrase_.data(), new Sink(string_)));
 }
 
 SafeString SecureString::string() const {
   SafeString decrypted_string;
-  Decoder decryptor(new Decryptor(phrase_.data(), new Sink(decrypted_string)));
+  Decryptor decryptor(phrase_.data(), new Sink(decrypted_string));
   decryptor.Put(reinterpret_cast<const byte*>(string_.data()), string_.length());
   decryptor.MessageEnd();
   return decrypted_string;
 }
 
+CharacterValidator::CharacterValidator(const boost::regex& regex) : regex_(regex), valid_() {
+  for (size_t i(0); i != valid_.size(); ++i) {
+    const char character(static_cast<char>(i));
+    valid_[i] = boost::regex_search(&character, &character + 1, regex) ? 1 : 0;
+  }
+}
+
+CharacterValidator CharacterValidator::Cached(const boost::regex& regex) {
+  // Bounded, since the patterns used for validation are normally a handful of constants.
+  const size_t kMaxCacheSize(64);
+  typedef std::pair<std::string, boost::regex::flag_type> Key;
+  static std::mutex mutex;
+  static std::map<Key, CharacterValidator> validators;
+  Key key(regex.str(), regex.flags());
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it(validators.find(key));
+    if (it != validators.end())
+      return it->second;
+  }
+  CharacterValidator validator(regex);
+  std::lock_guard<std::mutex> lock(mutex);
+  if (validators.size() == kMaxCacheSize)
+    validators.clear();
+  validators.insert(std::make_pair(key, validator));
+  return validator;
+}
+
+bool CharacterValidator::IsValid(const char* characters, size_t size) const {
+  // Accumulated without branching on each character, so long inputs are checked in one pass.
+  unsigned char valid(1);
+  for (size_t i(0); i != size; ++i)
+    valid &= valid_[static_cast<unsigned char>(characters[i])];
+  return valid != 0;
+}
+
+InputCipher::InputCipher()
+    : aes_(std::allocate_shared<CryptoPP::AES::Encryption>(
+          safe_allocator<CryptoPP::AES::Encryption>())),
+      next_nonce_(0) {
+  SafeString key(RandomSafeString<SafeString>(crypto::AES256_KeySize));
+  aes_->SetKey(reinterpret_cast<const byte*>(key.data()), key.size());
+}
+
+SafeString InputCipher::Encrypt(const char* decrypted_chars, size_t size) const {
+  uint64_t nonce(next_nonce_++);
+  SafeString encrypted_chars(sizeof(nonce) + size, 0);
+  std::memcpy(&encrypted_chars[0], &nonce, sizeof(nonce));
+  ApplyKeystream(nonce, decrypted_chars, &encrypted_chars[sizeof(nonce)], size);
+  return encrypted_chars;
+}
+
+SafeString InputCipher::Decrypt(const SafeString& encrypted_chars) const {
+  uint64_t nonce(0);
+  if (encrypted_chars.size() < sizeof(nonce))
+    ThrowError(CommonErrors::symmetric_encryption_error);
+  std::memcpy(&nonce, encrypted_chars.data(), sizeof(nonce));
+  SafeString decrypted_chars(encrypted_chars.size() - sizeof(nonce), 0);
+  ApplyKeystream(nonce, encrypted_chars.data() + sizeof(nonce), &decrypted_chars[0],
+                 decrypted_chars.size());
+  return decrypted_chars;
+}
+
+void InputCipher::ApplyKeystream(uint64_t nonce,
+                                 const char* input,
+                                 char* output,
+                                 size_t size) const {
+  CryptoPP::FixedSizeSecBlock<byte, CryptoPP::AES::BLOCKSIZE> counter, keystream;
+  std::memset(counter.BytePtr(), 0, CryptoPP::AES::BLOCKSIZE);
+  std::memcpy(counter.BytePtr(), &nonce, sizeof(nonce));
+  for (uint64_t block(0); size != 0; ++block) {
+    std::memcpy(counter.BytePtr() + sizeof(nonce), &block, sizeof(block));
+    aes_->ProcessBlock(counter.BytePtr(), keystream.BytePtr());
+    size_t block_size(std::min(size, static_cast<size_t>(CryptoPP::AES::BLOCKSIZE)));
+    for (size_t i(0); i != block_size; ++i)
+      *output++ = *input++ ^ static_cast<char>(keystream[i]);
+    size -= block_size;
+  }
+}
+
+EncryptedCharBuffer::EncryptedCharBuffer()
+    : buffer_(),
+      gap_begin_(0),
+      gap_end_(0),
+      entry_count_(0) {}
+
+void EncryptedCharBuffer::Insert(size_type position, SafeString encrypted_chars) {
+  if (position < size() && !(*this)[position].empty()) {
+    ReserveGap(1);
+    MoveGap(position);
+    buffer_[gap_begin_++].swap(encrypted_chars);
+  } else {
+    if (position >= size()) {
+      // Positions between the current end and 'position' are left empty.
+      ReserveGap(position + 1 - size());
+      MoveGap(size());
+      gap_begin_ = position + 1;
+    }
+    Slot(position).swap(encrypted_chars);
+  }
+  ++entry_count_;
+}
+
+void EncryptedCharBuffer::Remove(size_type position, size_type length) {
+  if (length == 0 || position >= size() || (*this)[position].empty() ||
+      length > size() - position) {
+    ThrowError(CommonErrors::invalid_parameter);
+  }
+  MoveGap(position);
+  for (size_type i(0); i != length; ++i, ++gap_end_) {
+    if (!buffer_[gap_end_].empty())
+      --entry_count_;
+    SafeString().swap(buffer_[gap_end_]);
+  }
+  // Positions are only meaningful up to the last entry.
+  if (size() != 0 && (*this)[size() - 1].empty()) {
+    MoveGap(size());
+    while (gap_begin_ != 0 && buffer_[gap_begin_ - 1].empty())
+      --gap_begin_;
+  }
+}
+
+void EncryptedCharBuffer::Clear() {
+  Buffer().swap(buffer_);
+  gap_begin_ = gap_end_ = entry_count_ = 0;
+}
+
+void EncryptedCharBuffer::MoveGap(size_type position) {
+  while (gap_begin_ > position)
+    buffer_[--gap_end_].swap(buffer_[--gap_begin_]);
+  while (gap_begin_ < position)
+    buffer_[gap_begin_++].swap(buffer_[gap_end_++]);
+}
+
+void EncryptedCharBuffer::ReserveGap(size_type gap_size) {
+  if (gap_end_ - gap_begin_ >= gap_size)
+    return;
+  const size_type kMinimumCapacity(32);
+  size_type tail_size(buffer_.size() - gap_end_);
+  Buffer grown(std::max(std::max(buffer_.size() * 2, size() + gap_size), kMinimumCapacity));
+  for (size_type i(0); i != gap_begin_; ++i)
+    grown[i].swap(buffer_[i]);
+  for (size_type i(0); i != tail_size; ++i)
+    grown[grown.size() - tail_size + i].swap(buffer_[gap_end_ + i]);
+  gap_end_ = grown.size() - tail_size;
+  buffer_.swap(grown);
+}
+
 SafeString operator+(const SafeString& first, const SafeString& second) {
   return SafeString(first.begin(), first.end()) + SafeString(second.begin(), second.end());
 }
@@ -65,6 +223,69 @@ SafeString operator+(const SafeString& first, const SecureString::Hash& second)
 // see safe_allocators.h
 LockedPageManager LockedPageManager::instance;
 
+const size_t SecureArena::kDefaultThreadCacheLimit;
+
+// Free lists of one thread, linked through the chunks themselves.
+class SecureArena::ThreadCache {
+ public:
+  explicit ThreadCache(SecureArena& arena) : arena_(arena), free_lists_(), counts_() {}
+
+  ~ThreadCache() {
+    for (size_t size_class(0); size_class != kSizeClassCount; ++size_class) {
+      while (void* chunk = Pop(size_class))
+        arena_.SecureArenaBase<MemoryPageLocker>::Deallocate(chunk, kChunkAlignment << size_class);
+    }
+  }
+
+  void* Pop(size_t size_class) {
+    FreeChunk* chunk(free_lists_[size_class]);
+    if (chunk) {
+      free_lists_[size_class] = chunk->next;
+      --counts_[size_class];
+    }
+    return chunk;
+  }
+
+  bool Push(void* ptr, size_t size_class, size_t limit) {
+    if (counts_[size_class] >= limit)
+      return false;
+    FreeChunk* chunk(static_cast<FreeChunk*>(ptr));
+    chunk->next = free_lists_[size_class];
+    free_lists_[size_class] = chunk;
+    ++counts_[size_class];
+    return true;
+  }
+
+ private:
+  ThreadCache(const ThreadCache&);
+  ThreadCache& operator=(const ThreadCache&);
+
+  SecureArena& arena_;
+  std::array<FreeChunk*, kSizeClassCount> free_lists_;
+  std::array<size_t, kSizeClassCount> counts_;
+};
+
+SecureArena::ThreadCache* SecureArena::GetThreadCache() {
+  // Never destroyed, for the same reason as the arena itself.
+  static boost::thread_specific_ptr<ThreadCache>* const thread_caches(
+      new boost::thread_specific_ptr<ThreadCache>);
+  if (!thread_caches->get())
+    thread_caches->reset(new ThreadCache(*this));
+  return thread_caches->get();
+}
+
+void* SecureArena::Allocate(size_t size) {
+  void* chunk(GetThreadCache()->Pop(SizeClass(size)));
+  return chunk ? chunk : SecureArenaBase<MemoryPageLocker>::Allocate(size);
+}
+
+void SecureArena::Deallocate(void* ptr, size_t size) {
+  if (!ptr)
+    return;
+  if (!GetThreadCache()->Push(ptr, SizeClass(size), thread_cache_limit_))
+    SecureArenaBase<MemoryPageLocker>::Deallocate(ptr, size);
+}
+
 }  // namespace detail
 }  // namespace passport
 }  // namespace maidsafe
@@ -0,0 +1,348 @@
+/*  Copyright 2013 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/passport/detail/signature_scheme.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "boost/thread/tss.hpp"
+
+#ifdef __MSVC__
+#  pragma warning(push, 1)
+#endif
+#include "cryptopp/filters.h"
+#include "cryptopp/osrng.h"
+#include "cryptopp/pubkey.h"
+#ifdef __MSVC__
+#  pragma warning(pop)
+#endif
+
+#include "maidsafe/common/error.h"
+#include "maidsafe/common/utils.h"
+
+
+namespace maidsafe {
+namespace passport {
+namespace detail {
+
+namespace {
+
+boost::thread_specific_ptr<CryptoPP::AutoSeededRandomPool> g_signing_rng;
+
+CryptoPP::RandomNumberGenerator& SigningRng() {
+  if (!g_signing_rng.get())
+    g_signing_rng.reset(new CryptoPP::AutoSeededRandomPool);
+  return *g_signing_rng;
+}
+
+// Takes an instance from 'idle' (or makes a new one if it's empty) for the exclusive use of the
+// calling thread, and returns it to 'idle' on destruction.
+template<typename T>
+class PooledInstance {
+ public:
+  template<typename MakeInstance>
+  PooledInstance(std::mutex& mutex, std::vector<std::unique_ptr<T>>& idle, MakeInstance make)
+      : mutex_(mutex), idle_(idle), instance_() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!idle_.empty()) {
+        instance_ = std::move(idle_.back());
+        idle_.pop_back();
+      }
+    }
+    if (!instance_)
+      instance_ = make();
+  }
+
+  ~PooledInstance() {
+    try {
+      std::lock_guard<std::mutex> lock(mutex_);
+      idle_.push_back(std::move(instance_));
+    }
+    catch(const std::exception&) {}  // the instance is simply discarded
+  }
+
+  const T& operator*() const { return *instance_; }
+  const T* operator->() const { return instance_.get(); }
+
+ private:
+  PooledInstance(const PooledInstance&);
+  PooledInstance& operator=(const PooledInstance&);
+
+  std::mutex& mutex_;
+  std::vector<std::unique_ptr<T>>& idle_;
+  std::unique_ptr<T> instance_;
+};
+
+template<typename Key>
+NonEmptyString SaveKey(const Key& key) {
+  std::string encoded_key;
+  CryptoPP::StringSink sink(encoded_key);
+  key.Save(sink);
+  return NonEmptyString(encoded_key);
+}
+
+template<typename Key, typename Error>
+Key LoadKey(const NonEmptyString& encoded_key, Error error) {
+  Key key;
+  try {
+    CryptoPP::StringSource source(encoded_key.string(), true);
+    key.Load(source);
+  }
+  catch(const CryptoPP::Exception&) {
+    ThrowError(error);
+  }
+  if (!key.Validate(SigningRng(), 2))
+    ThrowError(error);
+  return key;
+}
+
+template<typename Signer>
+asymm::Signature SignMessage(const Signer& signer,
+                             CryptoPP::RandomNumberGenerator& rng,
+                             const asymm::PlainText& data) {
+  std::string signature(signer.MaxSignatureLength(), 0);
+  signature.resize(signer.SignMessage(rng,
+                                      reinterpret_cast<const byte*>(data.string().data()),
+                                      data.string().size(),
+                                      reinterpret_cast<byte*>(&signature[0])));
+  return asymm::Signature(signature);
+}
+
+template<typename Verifier>
+bool VerifyMessage(const Verifier& verifier,
+                   const asymm::PlainText& data,
+                   const asymm::Signature& signature) {
+  if (signature.string().size() != verifier.SignatureLength())
+    return false;
+  return verifier.VerifyMessage(reinterpret_cast<const byte*>(data.string().data()),
+                                data.string().size(),
+                                reinterpret_cast<const byte*>(signature.string().data()),
+                                signature.string().size());
+}
+
+// Feeds 'data' to the accumulator's message hash, then finalises a copy of that hash so the
+// accumulator itself can still be used to produce or check the signature.
+crypto::SHA512Hash AccumulateAndHash(CryptoPP::PK_MessageAccumulator& accumulator,
+                                     const asymm::PlainText& data) {
+  accumulator.Update(reinterpret_cast<const byte*>(data.string().data()), data.string().size());
+  CryptoPP::SHA512 hash(dynamic_cast<CryptoPP::SHA512&>(
+      dynamic_cast<CryptoPP::PK_MessageAccumulatorBase&>(accumulator).AccessHash()));
+  std::string digest(CryptoPP::SHA512::DIGESTSIZE, 0);
+  hash.Final(reinterpret_cast<byte*>(&digest[0]));
+  return crypto::SHA512Hash(digest);
+}
+
+}  // unnamed namespace
+
+
+const SignatureSchemeId RsaScheme::kId;
+
+RsaScheme::Keys RsaScheme::GenerateKeyPair() {
+  return asymm::GenerateKeyPair();
+}
+
+NonEmptyString RsaScheme::EncodeKey(const PrivateKey& private_key) {
+  return NonEmptyString(asymm::EncodeKey(private_key).string());
+}
+
+NonEmptyString RsaScheme::EncodeKey(const PublicKey& public_key) {
+  return NonEmptyString(asymm::EncodeKey(public_key).string());
+}
+
+RsaScheme::PrivateKey RsaScheme::DecodePrivateKey(const NonEmptyString& encoded_private_key) {
+  return asymm::DecodeKey(asymm::EncodedPrivateKey(encoded_private_key.string()));
+}
+
+RsaScheme::PublicKey RsaScheme::DecodePublicKey(const NonEmptyString& encoded_public_key) {
+  return asymm::DecodeKey(asymm::EncodedPublicKey(encoded_public_key.string()));
+}
+
+asymm::Signature RsaScheme::Sign(const asymm::PlainText& data, const PrivateKey& private_key) {
+  return asymm::Sign(data, private_key);
+}
+
+bool RsaScheme::CheckSignature(const asymm::PlainText& data,
+                               const asymm::Signature& signature,
+                               const PublicKey& public_key) {
+  return asymm::CheckSignature(data, signature, public_key);
+}
+
+bool RsaScheme::MatchingKeys(const PrivateKey& private_key, const PublicKey& public_key) {
+  asymm::PlainText plain(RandomString(64));
+  return asymm::Decrypt(asymm::Encrypt(plain, public_key), private_key) == plain;
+}
+
+asymm::PlainText RsaScheme::Decrypt(const asymm::CipherText& data, const PrivateKey& private_key) {
+  return asymm::Decrypt(data, private_key);
+}
+
+
+const SignatureSchemeId EcdsaScheme::kId;
+
+EcdsaScheme::Keys EcdsaScheme::GenerateKeyPair() {
+  Keys keys;
+  keys.private_key.Initialize(SigningRng(), CryptoPP::ASN1::secp256r1());
+  keys.private_key.MakePublicKey(keys.public_key);
+  return keys;
+}
+
+NonEmptyString EcdsaScheme::EncodeKey(const PrivateKey& private_key) {
+  return SaveKey(private_key);
+}
+
+NonEmptyString EcdsaScheme::EncodeKey(const PublicKey& public_key) {
+  return SaveKey(public_key);
+}
+
+EcdsaScheme::PrivateKey EcdsaScheme::DecodePrivateKey(const NonEmptyString& encoded_private_key) {
+  return LoadKey<PrivateKey>(encoded_private_key, AsymmErrors::invalid_private_key);
+}
+
+EcdsaScheme::PublicKey EcdsaScheme::DecodePublicKey(const NonEmptyString& encoded_public_key) {
+  return LoadKey<PublicKey>(encoded_public_key, AsymmErrors::invalid_public_key);
+}
+
+asymm::Signature EcdsaScheme::Sign(const asymm::PlainText& data, const PrivateKey& private_key) {
+  return SignMessage(Signer(private_key), SigningRng(), data);
+}
+
+bool EcdsaScheme::CheckSignature(const asymm::PlainText& data,
+                                 const asymm::Signature& signature,
+                                 const PublicKey& public_key) {
+  return VerifyMessage(Verifier(public_key), data, signature);
+}
+
+bool EcdsaScheme::MatchingKeys(const PrivateKey& private_key, const PublicKey& public_key) {
+  PublicKey derived_public_key;
+  private_key.MakePublicKey(derived_public_key);
+  return derived_public_key.GetPublicElement() == public_key.GetPublicElement();
+}
+
+
+template<typename Scheme>
+CachedSigner<Scheme>::CachedSigner() : once_flag_(), mutex_(), idle_signers_() {}
+
+template<typename Scheme>
+asymm::Signature CachedSigner<Scheme>::Sign(const PrivateKey& private_key,
+                                            const asymm::PlainText& data) const {
+  PooledInstance<Signer> signer(mutex_, idle_signers_, [&] { return NewSigner(private_key); });
+  return SignMessage(*signer, SigningRng(), data);
+}
+
+template<typename Scheme>
+std::vector<asymm::Signature> CachedSigner<Scheme>::Sign(
+    const PrivateKey& private_key,
+    const std::vector<asymm::PlainText>& data) const {
+  PooledInstance<Signer> signer(mutex_, idle_signers_, [&] { return NewSigner(private_key); });
+  CryptoPP::RandomNumberGenerator& rng(SigningRng());
+  std::vector<asymm::Signature> signatures;
+  signatures.reserve(data.size());
+  for (const auto& plain_text : data)
+    signatures.push_back(SignMessage(*signer, rng, plain_text));
+  return signatures;
+}
+
+template<typename Scheme>
+asymm::Signature CachedSigner<Scheme>::Sign(const PrivateKey& private_key,
+                                            const asymm::PlainText& data,
+                                            crypto::SHA512Hash& digest) const {
+  PooledInstance<Signer> signer(mutex_, idle_signers_, [&] { return NewSigner(private_key); });
+  CryptoPP::RandomNumberGenerator& rng(SigningRng());
+  std::unique_ptr<CryptoPP::PK_MessageAccumulator> accumulator(
+      signer->NewSignatureAccumulator(rng));
+  digest = AccumulateAndHash(*accumulator, data);
+  std::string signature(signer->MaxSignatureLength(), 0);
+  signature.resize(signer->Sign(rng, accumulator.release(),
+                               reinterpret_cast<byte*>(&signature[0])));
+  return asymm::Signature(signature);
+}
+
+template<typename Scheme>
+std::unique_ptr<typename CachedSigner<Scheme>::Signer> CachedSigner<Scheme>::NewSigner(
+    const PrivateKey& private_key) const {
+  std::call_once(once_flag_, [&private_key] {
+    if (!private_key.Validate(SigningRng(), 0))
+      ThrowError(AsymmErrors::invalid_private_key);
+  });
+  return std::unique_ptr<Signer>(new Signer(private_key));
+}
+
+template class CachedSigner<RsaScheme>;
+template class CachedSigner<EcdsaScheme>;
+
+
+template<typename Scheme>
+CachedVerifier<Scheme>::CachedVerifier() : once_flag_(), mutex_(), idle_verifiers_() {}
+
+template<typename Scheme>
+bool CachedVerifier<Scheme>::Verify(const PublicKey& public_key,
+                                    const asymm::PlainText& data,
+                                    const asymm::Signature& signature) const {
+  PooledInstance<Verifier> verifier(mutex_, idle_verifiers_,
+                                    [&] { return NewVerifier(public_key); });
+  return VerifyMessage(*verifier, data, signature);
+}
+
+template<typename Scheme>
+bool CachedVerifier<Scheme>::Verify(const PublicKey& public_key,
+                                    const asymm::PlainText& data,
+                                    const asymm::Signature& signature,
+                                    crypto::SHA512Hash& digest) const {
+  PooledInstance<Verifier> verifier(mutex_, idle_verifiers_,
+                                    [&] { return NewVerifier(public_key); });
+  std::unique_ptr<CryptoPP::PK_MessageAccumulator> accumulator(
+      verifier->NewVerificationAccumulator());
+  digest = AccumulateAndHash(*accumulator, data);
+  if (signature.string().size() != verifier->SignatureLength())
+    return false;
+  verifier->InputSignature(*accumulator,
+                           reinterpret_cast<const byte*>(signature.string().data()),
+                           signature.string().size());
+  return verifier->Verify(accumulator.release());
+}
+
+template<typename Scheme>
+void CachedVerifier<Scheme>::Precompute(const PublicKey& public_key) const {
+  // Leaves a verifier in the pool, ready for the next call to Verify.
+  PooledInstance<Verifier> verifier(mutex_, idle_verifiers_,
+                                    [&] { return NewVerifier(public_key); });
+}
+
+template<typename Scheme>
+std::unique_ptr<typename CachedVerifier<Scheme>::Verifier> CachedVerifier<Scheme>::NewVerifier(
+    const PublicKey& public_key) const {
+  std::call_once(once_flag_, [&public_key] {
+    if (!public_key.Validate(SigningRng(), 0))
+      ThrowError(AsymmErrors::invalid_public_key);
+  });
+  std::unique_ptr<Verifier> verifier(new Verifier(public_key));
+  if (verifier->AccessKey().SupportsPrecomputation())
+    verifier->AccessKey().Precompute();
+  return verifier;
+}
+
+template class CachedVerifier<RsaScheme>;
+template class CachedVerifier<EcdsaScheme>;
+
+}  // namespace detail
+}  // namespace passport
+}  // namespace maidsafe
@@ -0,0 +1,93 @@
+/*  Copyright 2013 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/passport/detail/chain_validator.h"
+
+#include "maidsafe/common/test.h"
+#include "maidsafe/common/utils.h"
+
+#include "maidsafe/passport/types.h"
+
+
+namespace maidsafe {
+namespace passport {
+namespace detail {
+namespace test {
+
+TEST(ChainValidatorTest, BEH_ValidChains) {
+  Anmaid anmaid;
+  Maid maid(anmaid);
+  Pmid pmid(maid), pmid1(maid);
+  Maid maid1(anmaid);
+  Pmid pmid2(maid1);
+
+  ChainValidator validator;
+  EXPECT_TRUE(validator.Validate(PublicAnmaid(anmaid), PublicMaid(maid), PublicPmid(pmid)));
+  EXPECT_EQ(3U, validator.CachedLinkCount());
+  // Anmaid and Maid links are already known, only the new Pmid link gets verified
+  EXPECT_TRUE(validator.Validate(PublicAnmaid(anmaid), PublicMaid(maid), PublicPmid(pmid1)));
+  EXPECT_EQ(4U, validator.CachedLinkCount());
+  EXPECT_TRUE(validator.Validate(PublicAnmaid(anmaid), PublicMaid(maid1), PublicPmid(pmid2)));
+  EXPECT_EQ(6U, validator.CachedLinkCount());
+  EXPECT_TRUE(validator.Validate(PublicAnmaid(anmaid), PublicMaid(maid), PublicPmid(pmid)));
+  EXPECT_EQ(6U, validator.CachedLinkCount());
+
+  validator.Clear();
+  EXPECT_EQ(0U, validator.CachedLinkCount());
+  EXPECT_TRUE(validator.Validate(PublicAnmaid(anmaid), PublicMaid(maid1), PublicPmid(pmid2)));
+  EXPECT_EQ(3U, validator.CachedLinkCount());
+}
+
+TEST(ChainValidatorTest, BEH_InvalidChains) {
+  Anmaid anmaid, other_anmaid;
+  Maid maid(anmaid), other_maid(other_anmaid);
+  Pmid pmid(maid), other_pmid(other_maid);
+
+  ChainValidator validator;
+  EXPECT_FALSE(validator.Validate(PublicAnmaid(other_anmaid), PublicMaid(maid), PublicPmid(pmid)));
+  EXPECT_FALSE(validator.Validate(PublicAnmaid(anmaid), PublicMaid(maid), PublicPmid(other_pmid)));
+  EXPECT_FALSE(validator.Validate(PublicAnmaid(anmaid), PublicMaid(other_maid),
+                                  PublicPmid(other_pmid)));
+
+  // Correctly signed, but wrongly named
+  PublicMaid public_maid(maid);
+  PublicMaid misnamed_maid(PublicMaid::Name(Identity(RandomString(64))), public_maid.Serialise());
+  EXPECT_FALSE(validator.Validate(PublicAnmaid(anmaid), misnamed_maid, PublicPmid(pmid)));
+
+  // Only the links which passed should have been cached
+  EXPECT_EQ(3U, validator.CachedLinkCount());
+  EXPECT_TRUE(validator.Validate(PublicAnmaid(anmaid), PublicMaid(maid), PublicPmid(pmid)));
+  EXPECT_EQ(4U, validator.CachedLinkCount());
+}
+
+TEST(ChainValidatorTest, BEH_CacheLimit) {
+  Anmaid anmaid;
+  Maid maid(anmaid);
+  ChainValidator validator(4);
+  for (int i(0); i != 5; ++i) {
+    Pmid pmid(maid);
+    EXPECT_TRUE(validator.Validate(PublicAnmaid(anmaid), PublicMaid(maid), PublicPmid(pmid)));
+    EXPECT_GE(4U, validator.CachedLinkCount());
+  }
+  EXPECT_EQ(4U, validator.CachedLinkCount());
+}
+
+}  // namespace test
+}  // namespace detail
+}  // namespace passport
+}  // namespace maidsafe
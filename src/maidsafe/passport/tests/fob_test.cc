@@ -18,7 +18,9 @@
 
 #include "maidsafe/passport/detail/fob.h"
 
+#include <future>
 #include <string>
+#include <vector>
 
 #include "maidsafe/common/log.h"
 #include "maidsafe/common/rsa.h"
@@ -210,6 +212,132 @@ TEST(FobTest, BEH_NamingAndValidation) {
   EXPECT_TRUE(CheckNamingAndValidation(mpid, anmpid.public_key(), chosen_name));
 }
 
+template<typename Fobtype>
+bool CheckSigningAndDecryption(const Fobtype& fob) {
+  asymm::PlainText data(RandomString(1 + RandomUint32() % 1000));
+  if (!asymm::CheckSignature(data, fob.Sign(data), fob.public_key())) {
+    LOG(kError) << "Bad signature.";
+    return false;
+  }
+  if (fob.Decrypt(asymm::Encrypt(data, fob.public_key())) != data) {
+    LOG(kError) << "Bad decryption.";
+    return false;
+  }
+  std::vector<asymm::PlainText> batch;
+  for (int i(0); i != 5; ++i)
+    batch.push_back(asymm::PlainText(RandomString(1 + RandomUint32() % 1000)));
+  Fobtype fob_copy(fob);
+  auto signatures(fob_copy.Sign(batch));
+  if (signatures.size() != batch.size()) {
+    LOG(kError) << "Wrong number of signatures.";
+    return false;
+  }
+  for (size_t i(0); i != batch.size(); ++i) {
+    if (!asymm::CheckSignature(batch[i], signatures[i], fob.public_key())) {
+      LOG(kError) << "Bad batch signature.";
+      return false;
+    }
+  }
+  return true;
+}
+
+TEST(FobTest, BEH_SigningAndDecryption) {
+  Anmid anmid;
+  Anmaid anmaid;
+  Maid maid(anmaid);
+  Pmid pmid(maid);
+  Anmpid anmpid;
+  Mpid mpid(NonEmptyString(RandomAlphaNumericString(1 + RandomUint32() % 100)), anmpid);
+
+  EXPECT_TRUE(CheckSigningAndDecryption(anmid));
+  EXPECT_TRUE(CheckSigningAndDecryption(anmaid));
+  EXPECT_TRUE(CheckSigningAndDecryption(maid));
+  EXPECT_TRUE(CheckSigningAndDecryption(pmid));
+  EXPECT_TRUE(CheckSigningAndDecryption(anmpid));
+  EXPECT_TRUE(CheckSigningAndDecryption(mpid));
+
+  maidsafe::passport::detail::protobuf::Fob proto_fob;
+  maid.ToProtobuf(&proto_fob);
+  EXPECT_TRUE(CheckSigningAndDecryption(Maid(proto_fob)));
+
+  asymm::PlainText data(RandomString(100));
+  std::vector<std::future<asymm::Signature>> signatures;
+  for (int i(0); i != 10; ++i)
+    signatures.push_back(std::async(std::launch::async, [&] { return maid.Sign(data); }));
+  for (auto& signature : signatures)
+    EXPECT_TRUE(asymm::CheckSignature(data, signature.get(), maid.public_key()));
+
+  // Moved-from instances can still sign
+  Maid moved_from(maid), assigned_from(maid);
+  Maid moved_to(std::move(moved_from));
+  EXPECT_NO_THROW(moved_from.Sign(data));
+  moved_to = std::move(assigned_from);
+  EXPECT_NO_THROW(assigned_from.Sign(data));
+  Anmpid moved_anmpid(std::move(anmpid));
+  EXPECT_NO_THROW(anmpid.Sign(data));
+}
+
+template<typename Fobtype>
+bool CheckStreamedNameMatchesConcatenated(const Fobtype& fob) {
+  Identity expected(crypto::Hash<crypto::SHA512>(asymm::EncodeKey(fob.public_key()).string() +
+                                                 fob.validation_token().string()));
+  std::vector<Identity> batch(detail::CreateFobNames(
+      std::vector<asymm::PublicKey>(1, fob.public_key()),
+      std::vector<asymm::Signature>(1, fob.validation_token())));
+  return expected == detail::CreateFobName(fob.public_key(), fob.validation_token()) &&
+         batch.size() == 1U && expected == batch.front() && expected == Identity(fob.name());
+}
+
+TEST(FobTest, BEH_StreamedNameMatchesConcatenatedHash) {
+  Anmid anmid;
+  Ansmid ansmid;
+  Antmid antmid;
+  Anmaid anmaid;
+  Maid maid(anmaid);
+  Pmid pmid(maid);
+  Anmpid anmpid;
+  EXPECT_TRUE(CheckStreamedNameMatchesConcatenated(anmid));
+  EXPECT_TRUE(CheckStreamedNameMatchesConcatenated(ansmid));
+  EXPECT_TRUE(CheckStreamedNameMatchesConcatenated(antmid));
+  EXPECT_TRUE(CheckStreamedNameMatchesConcatenated(anmaid));
+  EXPECT_TRUE(CheckStreamedNameMatchesConcatenated(maid));
+  EXPECT_TRUE(CheckStreamedNameMatchesConcatenated(pmid));
+  EXPECT_TRUE(CheckStreamedNameMatchesConcatenated(anmpid));
+}
+
+TEST(FobTest, BEH_BatchNaming) {
+  Anmaid anmaid;
+  Maid maid(anmaid);
+  Pmid pmid(maid);
+
+  std::vector<asymm::PublicKey> public_keys;
+  std::vector<asymm::Signature> validation_tokens;
+  std::vector<Identity> expected_names;
+  // Enough entries to be split across several threads
+  for (int i(0); i != 200; ++i) {
+    public_keys.push_back(anmaid.public_key());
+    validation_tokens.push_back(anmaid.validation_token());
+    expected_names.push_back(Identity(anmaid.name()));
+    public_keys.push_back(maid.public_key());
+    validation_tokens.push_back(maid.validation_token());
+    expected_names.push_back(Identity(maid.name()));
+    public_keys.push_back(pmid.public_key());
+    validation_tokens.push_back(pmid.validation_token());
+    expected_names.push_back(Identity(pmid.name()));
+  }
+  EXPECT_TRUE(expected_names == detail::CreateFobNames(public_keys, validation_tokens));
+
+  public_keys.resize(2);
+  validation_tokens.resize(2);
+  expected_names.resize(2);
+  EXPECT_TRUE(expected_names == detail::CreateFobNames(public_keys, validation_tokens));
+
+  validation_tokens.pop_back();
+  EXPECT_THROW(detail::CreateFobNames(public_keys, validation_tokens), std::exception);
+  EXPECT_TRUE(detail::CreateFobNames(std::vector<asymm::PublicKey>(),
+                                     std::vector<asymm::Signature>()).empty());
+}
+
 }  // namespace test
 
 }  // namespace passport
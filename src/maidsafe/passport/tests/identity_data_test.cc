@@ -18,9 +18,12 @@
 
 #include "maidsafe/passport/detail/identity_data.h"
 
+#include <chrono>
 #include <future>
+#include <sstream>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "maidsafe/common/log.h"
 #include "maidsafe/common/test.h"
@@ -34,7 +37,36 @@ namespace passport {
 namespace detail {
 namespace test {
 
-TEST(IdentityPacketsTest, BEH_Full) {
+namespace {
+
+// A source which, like a pipe, can't be seeked.
+class NonSeekableBuffer : public std::stringbuf {
+ public:
+  explicit NonSeekableBuffer(const std::string& contents) : std::stringbuf(contents) {}
+
+ protected:
+  pos_type seekoff(off_type, std::ios_base::seekdir, std::ios_base::openmode) override {
+    return pos_type(off_type(-1));
+  }
+  pos_type seekpos(pos_type, std::ios_base::openmode) override { return pos_type(off_type(-1)); }
+};
+
+}  // unnamed namespace
+
+class IdentityPacketsTest : public testing::Test {
+ public:
+  IdentityPacketsTest()
+    : keyword_(RandomAlphaNumericString(20)),
+      password_(RandomAlphaNumericString(20)),
+      pin_(std::to_string(RandomUint32() % 9999 + 1)) {}
+
+ protected:
+  const Keyword keyword_;
+  const Password password_;
+  const Pin pin_;
+};
+
+TEST_F(IdentityPacketsTest, BEH_Full) {
   const Keyword kKeyword(RandomAlphaNumericString(20));
   const Password kPassword(RandomAlphaNumericString(20));
   const uint32_t kPinValue(RandomUint32() % 9999 + 1);
@@ -122,7 +154,164 @@ TEST(IdentityPacketsTest, BEH_Full) {
   static_assert(!is_long_term_cacheable<Tmid>::value, "");
 }
 
-TEST(IdentityPacketsTest, BEH_ChangeDetails) {
+TEST_F(IdentityPacketsTest, BEH_SessionCompression) {
+  std::string repetitive;
+  for (int i(0); i != 2000; ++i)
+    repetitive += "session " + std::to_string(i % 50) + RandomAlphaNumericString(2);
+  const NonEmptyString kCompressible(repetitive), kIncompressible(RandomString(10000));
+
+  LoginContext login_context(keyword_, pin_, password_, KdfPolicy());
+  auto compressed(login_context.EncryptSession(kCompressible, SessionCompression::kDeflate));
+  EXPECT_LT(compressed->string().size(), kCompressible.string().size() / 2);
+  EXPECT_EQ(compressed, login_context.EncryptSession(kCompressible, SessionCompression::kDeflate));
+  EXPECT_EQ(kCompressible, login_context.DecryptSession(compressed));
+  EXPECT_EQ(kCompressible,
+            maidsafe::passport::DecryptSession(keyword_, pin_, password_, compressed));
+  EXPECT_THROW(LoginContext(keyword_, pin_, Password(RandomAlphaNumericString(21)))
+                   .DecryptSession(compressed), std::exception);
+
+  // Sessions which deflating wouldn't shrink, or in the unversioned format, are left uncompressed
+  EXPECT_EQ(login_context.EncryptSession(kIncompressible),
+            login_context.EncryptSession(kIncompressible, SessionCompression::kDeflate));
+  LoginContext pin_scaled_context(keyword_, pin_, password_, KdfPolicy::PinScaled());
+  EXPECT_EQ(pin_scaled_context.EncryptSession(kCompressible),
+            pin_scaled_context.EncryptSession(kCompressible, SessionCompression::kDeflate));
+
+  // Streamed sessions compress too, and either form decrypts the other's output
+  std::istringstream source(repetitive);
+  std::ostringstream streamed;
+  login_context.EncryptSession(source, streamed, SessionCompression::kDeflate);
+  EXPECT_LT(streamed.str().size(), repetitive.size() / 2);
+  EXPECT_EQ(kCompressible,
+            login_context.DecryptSession(EncryptedSession(NonEmptyString(streamed.str()))));
+  std::istringstream compressed_source(compressed->string());
+  std::ostringstream plain_sink;
+  login_context.DecryptSession(compressed_source, plain_sink);
+  EXPECT_EQ(repetitive, plain_sink.str());
+}
+
+TEST_F(IdentityPacketsTest, BEH_ValidateTmid) {
+  const NonEmptyString kMasterData(RandomString(100000));
+  auto encrypted_session(EncryptSession(keyword_, pin_, password_, kMasterData));
+  Antmid antmid, other_antmid;
+  Tmid tmid(encrypted_session, antmid);
+  EXPECT_EQ(TmidData::Name(crypto::Hash<crypto::SHA512>(encrypted_session.data)), tmid.name());
+  EXPECT_TRUE(PublicAntmid(antmid).Verify(encrypted_session.data, tmid.validation_token()));
+  EXPECT_TRUE(ValidateTmid(tmid, PublicAntmid(antmid)));
+  EXPECT_FALSE(ValidateTmid(tmid, PublicAntmid(other_antmid)));
+
+  // A correctly signed session stored under the wrong name
+  Tmid misnamed_tmid(TmidData::Name(Identity(RandomString(64))), tmid.Serialise());
+  EXPECT_FALSE(ValidateTmid(misnamed_tmid, PublicAntmid(antmid)));
+}
+
+TEST_F(IdentityPacketsTest, BEH_PacketViews) {
+  auto encrypted_session(EncryptSession(keyword_, pin_, password_,
+                                        NonEmptyString(RandomString(10000))));
+  Antmid antmid;
+  Anmid anmid;
+  Tmid tmid(encrypted_session, antmid);
+  Mid mid(Mid::GenerateName(keyword_, pin_), EncryptTmidName(keyword_, pin_, tmid.name()), anmid);
+
+  auto serialised_tmid(tmid.Serialise());
+  TmidView tmid_view(tmid.name(), serialised_tmid);
+  EXPECT_EQ(tmid.name(), tmid_view.name());
+  EXPECT_EQ(tmid.encrypted_session()->string(), tmid_view.encrypted_session().to_string());
+  EXPECT_EQ(tmid.validation_token().string(), tmid_view.validation_token().to_string());
+  // The view refers into the serialised packet
+  const std::string& tmid_buffer(serialised_tmid->string());
+  EXPECT_GE(tmid_view.encrypted_session().data(), tmid_buffer.data());
+  EXPECT_LE(tmid_view.encrypted_session().data() + tmid_view.encrypted_session().size(),
+            tmid_buffer.data() + tmid_buffer.size());
+
+  auto serialised_mid(mid.Serialise());
+  MidView mid_view(mid.name(), serialised_mid);
+  EXPECT_EQ(mid.name(), mid_view.name());
+  EXPECT_EQ(mid.encrypted_tmid_name()->string(), mid_view.encrypted_tmid_name().to_string());
+  EXPECT_EQ(mid.validation_token().string(), mid_view.validation_token().to_string());
+
+  // Views validate the packet as the owning types do
+  const Smid::serialised_type kMidAsSmid(serialised_mid.data);
+  EXPECT_THROW(SmidView(Smid::Name(mid.name().value), kMidAsSmid), std::exception);
+  const Mid::serialised_type kTmidAsMid(serialised_tmid.data);
+  EXPECT_THROW(MidView(mid.name(), kTmidAsMid), std::exception);
+  std::string truncated(serialised_tmid->string());
+  truncated.resize(truncated.size() - 1);
+  const Tmid::serialised_type kTruncatedTmid((NonEmptyString(truncated)));
+  EXPECT_THROW(TmidView(tmid.name(), kTruncatedTmid), std::exception);
+  const Tmid::serialised_type kRandomTmid((NonEmptyString(RandomString(100))));
+  EXPECT_THROW(TmidView(tmid.name(), kRandomTmid), std::exception);
+}
+
+TEST_F(IdentityPacketsTest, BEH_ValidatePackets) {
+  Anmid anmid1, anmid2;
+  Antmid antmid1, antmid2;
+  std::vector<Mid> mids;
+  std::vector<PublicAnmid> public_anmids;
+  std::vector<Tmid> tmids;
+  std::vector<PublicAntmid> public_antmids;
+  for (int i(0); i != 20; ++i) {
+    // Each key is passed as a separately parsed copy, which should still share a verifier
+    const Anmid& anmid(i % 2 ? anmid1 : anmid2);
+    const Antmid& antmid(i % 2 ? antmid1 : antmid2);
+    auto session(EncryptSession(keyword_, pin_, password_, NonEmptyString(RandomString(1000))));
+    tmids.push_back(Tmid(session, antmid));
+    mids.push_back(Mid(Mid::GenerateName(keyword_, pin_),
+                       EncryptTmidName(keyword_, pin_, tmids.back().name()), anmid));
+    public_anmids.push_back(PublicAnmid(PublicAnmid::Name(anmid.name().value),
+                                        PublicAnmid(anmid).Serialise()));
+    public_antmids.push_back(PublicAntmid(PublicAntmid::Name(antmid.name().value),
+                                          PublicAntmid(antmid).Serialise()));
+  }
+  EXPECT_EQ(std::vector<bool>(20, true), ValidatePackets(mids, public_anmids));
+  EXPECT_EQ(std::vector<bool>(20, true), ValidatePackets(tmids, public_antmids));
+
+  // Packets checked against the wrong key or stored under the wrong name fail individually
+  std::swap(public_anmids[3], public_anmids[4]);
+  tmids[7] = Tmid(tmids[8].name(), tmids[7].Serialise());
+  std::vector<bool> expected(20, true);
+  expected[3] = expected[4] = false;
+  EXPECT_EQ(expected, ValidatePackets(mids, public_anmids));
+  expected[3] = expected[4] = true;
+  expected[7] = false;
+  EXPECT_EQ(expected, ValidatePackets(tmids, public_antmids));
+
+  // Batches large enough to be split across threads give the same results
+  std::vector<Tmid> many_tmids;
+  std::vector<PublicAntmid> many_public_antmids;
+  std::vector<bool> many_expected;
+  for (int i(0); i != 10; ++i) {
+    many_tmids.insert(many_tmids.end(), tmids.begin(), tmids.end());
+    many_public_antmids.insert(many_public_antmids.end(), public_antmids.begin(),
+                               public_antmids.end());
+    many_expected.insert(many_expected.end(), expected.begin(), expected.end());
+  }
+  EXPECT_EQ(many_expected, ValidatePackets(many_tmids, many_public_antmids));
+
+  // Two different keys claiming the same name are each used for their own packets
+  std::swap(public_anmids[3], public_anmids[4]);
+  public_anmids[0] = PublicAnmid(PublicAnmid::Name(anmid1.name().value),
+                                 PublicAnmid(anmid2).Serialise());
+  public_anmids[1] = PublicAnmid(PublicAnmid::Name(anmid1.name().value),
+                                 PublicAnmid(anmid1).Serialise());
+  expected.assign(20, true);
+  EXPECT_EQ(expected, ValidatePackets(mids, public_anmids));
+  public_anmids[0] = PublicAnmid(PublicAnmid::Name(anmid2.name().value),
+                                 PublicAnmid(anmid1).Serialise());
+  expected[0] = false;
+  EXPECT_EQ(expected, ValidatePackets(mids, public_anmids));
+
+  Smid smid(Smid::GenerateName(keyword_, pin_),
+            EncryptTmidName(keyword_, pin_, tmids.front().name()), Ansmid());
+  EXPECT_EQ(std::vector<bool>(1, false),
+            ValidatePackets(std::vector<Smid>(1, smid), std::vector<PublicAnsmid>(1,
+                            PublicAnsmid(Ansmid()))));
+  EXPECT_TRUE(ValidatePackets(std::vector<Mid>(), std::vector<PublicAnmid>()).empty());
+  public_anmids.pop_back();
+  EXPECT_THROW(ValidatePackets(mids, public_anmids), std::exception);
+}
+
+TEST_F(IdentityPacketsTest, BEH_ChangeDetails) {
   const Keyword kKeyword(RandomAlphaNumericString(20)),
                 kNewKeyword(RandomAlphaNumericString(20));
   const Password kPassword(RandomAlphaNumericString(20));
@@ -140,6 +329,198 @@ TEST(IdentityPacketsTest, BEH_ChangeDetails) {
   ASSERT_TRUE(dec1 == next_master2);
 }
 
+TEST_F(IdentityPacketsTest, BEH_LoginContext) {
+  const NonEmptyString kMasterData(RandomString(34567));
+  const TmidData::Name kTmidName(Identity(RandomString(64)));
+
+  LoginContext login_context(keyword_, pin_, password_);
+  EXPECT_EQ(MidData<MidTag>::GenerateName(keyword_, pin_), login_context.MidName());
+  EXPECT_EQ(MidData<SmidTag>::GenerateName(keyword_, pin_), login_context.SmidName());
+
+  // Results must be identical to, and interchangeable with, those of the free functions
+  auto encrypted_session(EncryptSession(keyword_, pin_, password_, kMasterData));
+  auto encrypted_tmid_name(EncryptTmidName(keyword_, pin_, kTmidName));
+  EXPECT_EQ(encrypted_session, login_context.EncryptSession(kMasterData));
+  EXPECT_EQ(encrypted_tmid_name, login_context.EncryptTmidName(kTmidName));
+  EXPECT_EQ(kMasterData, login_context.DecryptSession(encrypted_session));
+  EXPECT_EQ(kTmidName, login_context.DecryptTmidName(encrypted_tmid_name));
+
+  // Concurrent use of a single context
+  std::vector<std::future<NonEmptyString>> results;
+  LoginContext fresh_context(keyword_, pin_, password_);
+  for (int i(0); i != 4; ++i) {
+    results.push_back(std::async(std::launch::async, [&] {
+      return fresh_context.DecryptSession(encrypted_session);
+    }));
+  }
+  for (auto& result : results)
+    EXPECT_EQ(kMasterData, result.get());
+
+  // Deriving all keys up front gives the same results
+  LoginContext derived_context(keyword_, pin_, password_);
+  derived_context.DeriveKeys();
+  EXPECT_EQ(encrypted_session, derived_context.EncryptSession(kMasterData));
+  EXPECT_EQ(kTmidName, derived_context.DecryptTmidName(encrypted_tmid_name));
+
+  // Without a password, session encryption is unavailable
+  LoginContext partial_context(keyword_, pin_);
+  EXPECT_EQ(login_context.MidName(), partial_context.MidName());
+  EXPECT_EQ(kTmidName, partial_context.DecryptTmidName(encrypted_tmid_name));
+  EXPECT_THROW(partial_context.EncryptSession(kMasterData), std::exception);
+  EXPECT_THROW(partial_context.DecryptSession(encrypted_session), std::exception);
+  partial_context.DeriveKeys();
+  EXPECT_EQ(encrypted_tmid_name, partial_context.EncryptTmidName(kTmidName));
+}
+
+TEST_F(IdentityPacketsTest, BEH_KdfPolicy) {
+  const NonEmptyString kMasterData(RandomString(1000));
+  const TmidData::Name kTmidName(Identity(RandomString(64)));
+
+  EXPECT_THROW(KdfPolicy(KdfPolicy::kMinimumIterations - 1), std::exception);
+  KdfPolicy calibrated_policy(CalibrateKdfPolicy(std::chrono::milliseconds(50)));
+  EXPECT_EQ(KdfPolicy::Version::kFixed, calibrated_policy.version);
+  EXPECT_GE(calibrated_policy.iterations, KdfPolicy::kMinimumIterations);
+
+  // The policy is recorded with the data, and is only kFixed when asked for explicitly
+  auto encrypted_session(EncryptSession(keyword_, pin_, password_, kMasterData, KdfPolicy()));
+  auto encrypted_tmid_name(EncryptTmidName(keyword_, pin_, kTmidName, KdfPolicy()));
+  EXPECT_EQ(KdfPolicy(), GetKdfPolicy(encrypted_session));
+  EXPECT_EQ(KdfPolicy(), GetKdfPolicy(encrypted_tmid_name));
+
+  auto pin_scaled_session(EncryptSession(keyword_, pin_, password_, kMasterData));
+  auto pin_scaled_tmid_name(EncryptTmidName(keyword_, pin_, kTmidName));
+  EXPECT_EQ(KdfPolicy::PinScaled(), GetKdfPolicy(pin_scaled_session));
+  EXPECT_EQ(KdfPolicy::PinScaled(), GetKdfPolicy(pin_scaled_tmid_name));
+  EXPECT_NE(encrypted_session, pin_scaled_session);
+  LoginContext default_context(keyword_, pin_, password_);
+  EXPECT_EQ(pin_scaled_session, default_context.EncryptSession(kMasterData));
+  EXPECT_EQ(pin_scaled_tmid_name, default_context.EncryptTmidName(kTmidName));
+
+  const KdfPolicy kCustomPolicy(KdfPolicy::kMinimumIterations + RandomUint32() % 1000);
+  LoginContext custom_context(keyword_, pin_, password_, kCustomPolicy);
+  auto custom_session(custom_context.EncryptSession(kMasterData));
+  auto custom_tmid_name(custom_context.EncryptTmidName(kTmidName));
+  EXPECT_EQ(kCustomPolicy, GetKdfPolicy(custom_session));
+  EXPECT_EQ(kCustomPolicy, GetKdfPolicy(custom_tmid_name));
+
+  // Data written under any policy is decryptable, whatever the policy of the decrypting context
+  for (const auto& kdf_policy : { KdfPolicy(), KdfPolicy::PinScaled(), kCustomPolicy }) {
+    LoginContext login_context(keyword_, pin_, password_, kdf_policy);
+    EXPECT_EQ(kMasterData, login_context.DecryptSession(encrypted_session));
+    EXPECT_EQ(kMasterData, login_context.DecryptSession(pin_scaled_session));
+    EXPECT_EQ(kMasterData, login_context.DecryptSession(custom_session));
+    EXPECT_EQ(kTmidName, login_context.DecryptTmidName(encrypted_tmid_name));
+    EXPECT_EQ(kTmidName, login_context.DecryptTmidName(pin_scaled_tmid_name));
+    EXPECT_EQ(kTmidName, login_context.DecryptTmidName(custom_tmid_name));
+  }
+}
+
+TEST_F(IdentityPacketsTest, BEH_StreamingSession) {
+  const std::string kMasterData(RandomString(50 * 1024 + RandomUint32() % 1000));
+
+  for (const auto& kdf_policy : { KdfPolicy(), KdfPolicy::PinScaled() }) {
+    LoginContext login_context(keyword_, pin_, password_, kdf_policy);
+    auto encrypted_session(login_context.EncryptSession(NonEmptyString(kMasterData)));
+
+    // Streamed encryption matches non-streamed, and each decrypts the other's output
+    std::istringstream plain_source(kMasterData);
+    std::ostringstream encrypted_sink;
+    login_context.EncryptSession(plain_source, encrypted_sink);
+    EXPECT_EQ(encrypted_session->string(), encrypted_sink.str());
+
+    std::istringstream encrypted_source(encrypted_session->string());
+    std::ostringstream plain_sink;
+    login_context.DecryptSession(encrypted_source, plain_sink);
+    EXPECT_EQ(kMasterData, plain_sink.str());
+    EXPECT_EQ(kMasterData, maidsafe::passport::DecryptSession(keyword_, pin_, password_,
+                                                              encrypted_session).string());
+
+    std::istringstream free_function_source(encrypted_session->string());
+    std::ostringstream free_function_sink;
+    DecryptSession(keyword_, pin_, password_, free_function_source, free_function_sink);
+    EXPECT_EQ(kMasterData, free_function_sink.str());
+  }
+
+  // A session short enough to be consumed entirely while looking for a format header
+  LoginContext pin_scaled_context(keyword_, pin_, password_, KdfPolicy::PinScaled());
+  const NonEmptyString kShortData(RandomString(3));
+  std::istringstream short_source(pin_scaled_context.EncryptSession(kShortData)->string());
+  std::ostringstream short_sink;
+  pin_scaled_context.DecryptSession(short_source, short_sink);
+  EXPECT_EQ(kShortData.string(), short_sink.str());
+
+  // Only the authenticated format needs to seek its source
+  NonSeekableBuffer pin_scaled_buffer(kMasterData), fixed_buffer(kMasterData);
+  std::istream pin_scaled_pipe(&pin_scaled_buffer), fixed_pipe(&fixed_buffer);
+  std::ostringstream pipe_sink;
+  pin_scaled_context.EncryptSession(pin_scaled_pipe, pipe_sink);
+  EXPECT_EQ(pin_scaled_context.EncryptSession(NonEmptyString(kMasterData))->string(),
+            pipe_sink.str());
+  EXPECT_THROW(LoginContext(keyword_, pin_, password_, KdfPolicy()).EncryptSession(fixed_pipe,
+                                                                                   pipe_sink),
+               std::exception);
+
+  // Versioned cipher text is read only as far as its recorded size.  A Tmid name encrypted under a
+  // kFixed policy is in the versioned format which sessions were once written in; decrypting it as
+  // a session gives meaningless output, but the same output whether streamed or not.
+  LoginContext fixed_context(keyword_, pin_, password_, KdfPolicy());
+  std::string versioned(
+      fixed_context.EncryptTmidName(TmidData::Name(Identity(RandomString(64))))->string());
+  NonEmptyString expected(
+      fixed_context.DecryptSession(EncryptedSession(NonEmptyString(versioned))));
+  std::istringstream trailing_source(versioned + RandomString(1 + RandomUint32() % 100));
+  std::ostringstream trailing_sink;
+  fixed_context.DecryptSession(trailing_source, trailing_sink);
+  EXPECT_EQ(expected.string(), trailing_sink.str());
+  std::istringstream truncated_source(versioned.substr(0, versioned.size() - 1));
+  std::ostringstream truncated_sink;
+  EXPECT_THROW(fixed_context.DecryptSession(truncated_source, truncated_sink), std::exception);
+
+  std::istringstream empty_source;
+  std::ostringstream sink;
+  LoginContext login_context(keyword_, pin_, password_);
+  EXPECT_THROW(login_context.EncryptSession(empty_source, sink), std::exception);
+  EXPECT_THROW(login_context.DecryptSession(empty_source, sink), std::exception);
+}
+
+TEST_F(IdentityPacketsTest, BEH_AuthenticatedSession) {
+  const Password kWrongPassword(RandomAlphaNumericString(21));
+  const NonEmptyString kMasterData(RandomString(1000 + RandomUint32() % 1000));
+
+  LoginContext login_context(keyword_, pin_, password_, KdfPolicy());
+  LoginContext wrong_context(keyword_, pin_, kWrongPassword, KdfPolicy());
+  auto encrypted_session(login_context.EncryptSession(kMasterData));
+  EXPECT_EQ(kMasterData, login_context.DecryptSession(encrypted_session));
+  EXPECT_THROW(wrong_context.DecryptSession(encrypted_session), std::exception);
+
+  // Any modification is detected
+  std::string modified(encrypted_session->string());
+  modified[modified.size() - 1 - RandomUint32() % kMasterData.string().size()] ^= 1;
+  EXPECT_THROW(login_context.DecryptSession(EncryptedSession(NonEmptyString(modified))),
+               std::exception);
+
+  std::istringstream source(encrypted_session->string());
+  std::ostringstream sink;
+  EXPECT_THROW(wrong_context.DecryptSession(source, sink), std::exception);
+  EXPECT_TRUE(sink.str().empty());
+  std::istringstream modified_source(modified);
+  EXPECT_THROW(login_context.DecryptSession(modified_source, sink), std::exception);
+
+  // The free functions only write the authenticated format when given a policy which selects it
+  EXPECT_EQ(encrypted_session, EncryptSession(keyword_, pin_, password_, kMasterData, KdfPolicy()));
+  auto unauthenticated_session(EncryptSession(keyword_, pin_, password_, kMasterData));
+  std::istringstream unauthenticated_source(kMasterData.string());
+  std::ostringstream unauthenticated_sink;
+  EncryptSession(keyword_, pin_, password_, unauthenticated_source, unauthenticated_sink);
+  EXPECT_EQ(unauthenticated_session->string(), unauthenticated_sink.str());
+  std::string unauthenticated_modified(unauthenticated_session->string());
+  unauthenticated_modified[unauthenticated_modified.size() - 1] ^= 1;
+  NonEmptyString undetected;
+  EXPECT_NO_THROW(undetected = maidsafe::passport::DecryptSession(keyword_, pin_, password_,
+      EncryptedSession(NonEmptyString(unauthenticated_modified))));
+  EXPECT_FALSE(kMasterData == undetected);
+}
+
 }  // namespace test
 }  // namespace detail
 }  // namespace passport
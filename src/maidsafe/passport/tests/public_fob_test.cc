@@ -18,6 +18,9 @@
 
 #include "maidsafe/passport/detail/public_fob.h"
 
+#include <future>
+#include <vector>
+
 #include "maidsafe/common/test.h"
 #include "maidsafe/common/utils.h"
 
@@ -236,6 +239,47 @@ TEST(PublicFobTest, BEH_SerialiseUninitialisedMessage) {
   EXPECT_THROW(NonEmptyString(proto_public_fob.SerializeAsString()), std::exception);
 }
 
+TEST(PublicFobTest, BEH_Verify) {
+  Anmaid anmaid;
+  Maid maid(anmaid);
+  PublicMaid public_maid(maid);
+  asymm::PlainText data(RandomString(1 + RandomUint32() % 1000));
+  asymm::Signature signature(asymm::Sign(data, maid.private_key()));
+
+  EXPECT_TRUE(public_maid.Verify(data, signature));
+  EXPECT_TRUE(public_maid.Verify(data, signature));
+  EXPECT_FALSE(public_maid.Verify(asymm::PlainText(RandomString(10)), signature));
+  EXPECT_FALSE(public_maid.Verify(data, asymm::Sign(data, anmaid.private_key())));
+  EXPECT_FALSE(public_maid.Verify(data, asymm::Signature(RandomString(10))));
+
+  // Copies, including those made after the verifier was built, and parsed instances must agree
+  PublicMaid public_maid_copy(public_maid);
+  PublicMaid parsed_public_maid(public_maid.name(), public_maid.Serialise());
+  parsed_public_maid.PrecomputeVerifier();
+  EXPECT_TRUE(public_maid_copy.Verify(data, signature));
+  EXPECT_TRUE(parsed_public_maid.Verify(data, signature));
+  EXPECT_FALSE(parsed_public_maid.Verify(data, asymm::Sign(data, anmaid.private_key())));
+
+  std::vector<std::future<bool>> results;
+  for (int i(0); i != 10; ++i) {
+    results.push_back(std::async(std::launch::async, [&] {
+      return public_maid_copy.Verify(data, signature);
+    }));
+  }
+  for (auto& result : results)
+    EXPECT_TRUE(result.get());
+
+  // Moved-from instances keep a usable verifier
+  PublicMaid moved_to(std::move(public_maid_copy));
+  EXPECT_TRUE(moved_to.Verify(data, signature));
+  EXPECT_NO_THROW(public_maid_copy.Verify(data, signature));
+  moved_to = std::move(parsed_public_maid);
+  PublicMaid assigned_from_moved(public_maid);
+  assigned_from_moved = parsed_public_maid;
+  EXPECT_NO_THROW(assigned_from_moved.PrecomputeVerifier());
+  EXPECT_NO_THROW(assigned_from_moved.Verify(data, signature));
+}
+
 }  // namespace test
 
 }  // namespace passport
@@ -16,6 +16,17 @@
     See the Licences for the specific language governing permissions and limitations relating to
     use of the MaidSafe Software.                                                                 */
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
 #include "boost/regex.hpp"
 
 #include "maidsafe/common/error.h"
@@ -36,6 +47,242 @@ typedef passport::detail::SafeString SafeString;
 typedef passport::detail::Password Password;
 typedef passport::detail::Pin Pin;
 
+class StubLocker {
+ public:
+  bool Lock(const void* /*address*/, size_t /*length*/) { return true; }
+  bool Unlock(const void* /*address*/, size_t /*length*/) { return true; }
+};
+
+TEST(SecureWipeTest, BEH_WipeRanges) {
+  for (size_t size : {0, 1, 7, 64, 1000, 65537}) {
+    for (size_t offset : {0, 1, 3}) {
+      std::vector<char> buffer(size + offset + 8, 'x');
+      passport::detail::SecureWipe(buffer.data() + offset, size);
+      EXPECT_EQ(std::string(offset, 'x'), std::string(buffer.data(), offset));
+      EXPECT_EQ(std::string(size, '\0'), std::string(buffer.data() + offset, size));
+      EXPECT_EQ(std::string(8, 'x'), std::string(buffer.data() + offset + size, 8));
+    }
+  }
+}
+
+// Records the net number of lock calls made per page.
+class CountingLocker {
+ public:
+  bool Lock(const void* address, size_t /*length*/) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++lock_counts_[address];
+    return true;
+  }
+  bool Unlock(const void* address, size_t /*length*/) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --lock_counts_[address];
+    return true;
+  }
+  static int LockCount(const void* address) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lock_counts_[address];
+  }
+
+ private:
+  static std::mutex mutex_;
+  static std::map<const void*, int> lock_counts_;
+};
+
+std::mutex CountingLocker::mutex_;
+std::map<const void*, int> CountingLocker::lock_counts_;
+
+TEST(LockedPageManagerTest, BEH_LockAndUnlockRanges) {
+  const size_t kPageSize(4096);
+  passport::detail::LockedPageManagerBase<CountingLocker> manager(kPageSize);
+  std::vector<char> buffer(kPageSize * 200);
+  char* const first_page(reinterpret_cast<char*>(
+      (reinterpret_cast<size_t>(buffer.data()) + kPageSize - 1) & ~(kPageSize - 1)));
+
+  // Overlapping ranges lock each page only once, spanning several shards
+  manager.LockRange(first_page + 10, kPageSize * 100);
+  manager.LockRange(first_page + kPageSize * 50, kPageSize * 100);
+  EXPECT_EQ(150, manager.GetLockedPageCount());
+  for (size_t i(0); i != 150; ++i)
+    EXPECT_EQ(1, CountingLocker::LockCount(first_page + kPageSize * i));
+
+  // Pages stay locked until the last range covering them is unlocked
+  manager.UnlockRange(first_page + 10, kPageSize * 100);
+  EXPECT_EQ(100, manager.GetLockedPageCount());
+  for (size_t i(0); i != 150; ++i)
+    EXPECT_EQ(i < 50 ? 0 : 1, CountingLocker::LockCount(first_page + kPageSize * i));
+  manager.UnlockRange(first_page + kPageSize * 50, kPageSize * 100);
+  EXPECT_EQ(0, manager.GetLockedPageCount());
+  for (size_t i(0); i != 150; ++i)
+    EXPECT_EQ(0, CountingLocker::LockCount(first_page + kPageSize * i));
+
+  manager.LockRange(first_page, 0);
+  EXPECT_EQ(0, manager.GetLockedPageCount());
+}
+
+// Fails to lock every other page, as happens on reaching the locked memory limit.
+class FlakyLocker {
+ public:
+  FlakyLocker() : lock_count_(0) {}
+  bool Lock(const void* /*address*/, size_t /*length*/) { return ++lock_count_ % 2 == 0; }
+  bool Unlock(const void* /*address*/, size_t /*length*/) { return true; }
+
+ private:
+  int lock_count_;
+};
+
+TEST(LockedPageManagerTest, BEH_Stats) {
+  const size_t kPageSize(4096);
+  passport::detail::LockedPageManagerBase<FlakyLocker> manager(kPageSize);
+  std::vector<char> buffer(kPageSize * 20);
+  char* const first_page(reinterpret_cast<char*>(
+      (reinterpret_cast<size_t>(buffer.data()) + kPageSize - 1) & ~(kPageSize - 1)));
+
+  manager.LockRange(first_page, kPageSize * 10);
+  manager.LockRange(first_page + 100, 200);
+  passport::detail::LockedMemoryStats stats;
+  manager.GetStats(stats);
+  // Only the even-numbered pages were locked
+  EXPECT_EQ(5U, stats.locked_pages);
+  EXPECT_EQ(5U, stats.peak_locked_pages);
+  EXPECT_EQ(5U, stats.failed_pages);
+  EXPECT_EQ(kPageSize, stats.page_size);
+  EXPECT_EQ(kPageSize * 10 + 200, stats.requested_bytes);
+  EXPECT_EQ(10U, stats.lock_calls);
+  EXPECT_EQ(5U, stats.lock_failures);
+  EXPECT_EQ(0U, stats.unlock_calls);
+
+  // Pages whose lock failed aren't unlocked
+  manager.UnlockRange(first_page, kPageSize * 10);
+  manager.GetStats(stats);
+  EXPECT_EQ(0U, stats.locked_pages);
+  EXPECT_EQ(5U, stats.peak_locked_pages);
+  EXPECT_EQ(1U, stats.failed_pages);
+  EXPECT_EQ(200U, stats.requested_bytes);
+  EXPECT_EQ(5U, stats.unlock_calls);
+  EXPECT_EQ(0U, stats.unlock_failures);
+  manager.UnlockRange(first_page + 100, 200);
+  manager.GetStats(stats);
+  EXPECT_EQ(0U, stats.locked_pages);
+  EXPECT_EQ(0U, stats.failed_pages);
+  EXPECT_EQ(0U, stats.requested_bytes);
+  EXPECT_EQ(10U, stats.lock_calls);
+  EXPECT_EQ(5U, stats.unlock_calls);
+}
+
+TEST(LockedPageManagerTest, BEH_GlobalStats) {
+  SafeString small(100, 'a'), large(passport::detail::SecureArena::kMaxChunkSize + 1, 'b');
+  passport::detail::LockedMemoryStats stats(passport::detail::GetLockedMemoryStats());
+  EXPECT_LE(1U, stats.locked_pages + stats.failed_pages);
+  EXPECT_LE(stats.locked_pages, stats.peak_locked_pages);
+  EXPECT_LE(large.capacity(), stats.requested_bytes);
+  EXPECT_LE(1U, stats.arena_regions);
+  EXPECT_LT(0U, stats.locked_bytes_limit);
+}
+
+// Measures lock/unlock throughput with threads working on neighbouring pages, as happens when
+// many threads allocate small secure strings concurrently.
+TEST(LockedPageManagerTest, FUNC_Contention) {
+  const size_t kPageSize(4096), kOperationsPerThread(200000);
+  const size_t max_threads(std::max(4U, std::thread::hardware_concurrency()));
+  std::vector<char> buffer(kPageSize * (max_threads * 2 + 1));
+  for (size_t thread_count(1); thread_count <= max_threads; thread_count *= 2) {
+    passport::detail::LockedPageManagerBase<StubLocker> manager(kPageSize);
+    auto start(std::chrono::steady_clock::now());
+    std::vector<std::future<void>> workers;
+    for (size_t i(0); i != thread_count; ++i) {
+      workers.push_back(std::async(std::launch::async, [&, i] {
+        char* const range(buffer.data() + kPageSize * 2 * i);
+        for (size_t j(0); j != kOperationsPerThread; ++j) {
+          manager.LockRange(range, 64);
+          manager.UnlockRange(range, 64);
+        }
+      }));
+    }
+    for (auto& worker : workers)
+      worker.get();
+    auto elapsed(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count());
+    EXPECT_EQ(0, manager.GetLockedPageCount());
+    LOG(kInfo) << thread_count << " thread(s): "
+               << (thread_count * kOperationsPerThread * 1000000) / std::max<int64_t>(elapsed, 1)
+               << " lock/unlock pairs per second";
+  }
+}
+
+TEST(SecureArenaTest, BEH_AllocateAndRecycle) {
+  typedef passport::detail::SecureArenaBase<StubLocker> Arena;
+  const size_t kPageSize(4096);
+  Arena arena(kPageSize, 3 * kPageSize - 1);
+  ASSERT_EQ(3 * kPageSize, arena.region_size());
+  EXPECT_EQ(0, arena.GetRegionCount());
+
+  std::vector<std::pair<char*, size_t>> chunks;
+  for (size_t size(1); size <= Arena::kMaxChunkSize; size += 97) {
+    char* chunk(static_cast<char*>(arena.Allocate(size)));
+    ASSERT_NE(nullptr, chunk);
+    EXPECT_EQ(0, reinterpret_cast<size_t>(chunk) % Arena::kChunkAlignment);
+    std::fill(chunk, chunk + size, static_cast<char>(size));
+    chunks.push_back(std::make_pair(chunk, size));
+  }
+  // All chunks are usable and don't overlap
+  for (const auto& chunk : chunks) {
+    EXPECT_EQ(std::string(chunk.second, static_cast<char>(chunk.second)),
+              std::string(chunk.first, chunk.second));
+  }
+  const size_t region_count(arena.GetRegionCount());
+  EXPECT_LT(1, region_count);
+
+  // Freed chunks are reused rather than new regions reserved
+  for (int i(0); i != 10; ++i) {
+    for (const auto& chunk : chunks)
+      arena.Deallocate(chunk.first, chunk.second);
+    for (auto& chunk : chunks)
+      chunk.first = static_cast<char*>(arena.Allocate(chunk.second));
+  }
+  EXPECT_EQ(region_count, arena.GetRegionCount());
+}
+
+TEST(SecureArenaTest, BEH_ThreadCaches) {
+  passport::detail::SecureArena& arena(passport::detail::SecureArena::Instance());
+  const size_t kSize(2000);
+  arena.SetThreadCacheLimit(2);
+  std::vector<void*> freed;
+  std::thread([&] {
+    std::vector<void*> chunks;
+    for (int i(0); i != 4; ++i)
+      chunks.push_back(arena.Allocate(kSize));
+    for (void* chunk : chunks)
+      arena.Deallocate(chunk, kSize);
+    // The last two chunks freed exceeded the cache limit; the first two are recycled from the cache
+    EXPECT_EQ(chunks[1], arena.Allocate(kSize));
+    EXPECT_EQ(chunks[0], arena.Allocate(kSize));
+    arena.Deallocate(chunks[0], kSize);
+    arena.Deallocate(chunks[1], kSize);
+    freed = chunks;
+  }).join();
+
+  // The exited thread's cache has been returned to the arena
+  arena.SetThreadCacheLimit(passport::detail::SecureArena::kDefaultThreadCacheLimit);
+  std::thread([&] {
+    std::vector<void*> chunks;
+    for (int i(0); i != 4; ++i) {
+      chunks.push_back(arena.Allocate(kSize));
+      EXPECT_NE(freed.end(), std::find(freed.begin(), freed.end(), chunks.back()));
+    }
+    for (void* chunk : chunks)
+      arena.Deallocate(chunk, kSize);
+  }).join();
+}
+
+TEST(SecureArenaTest, BEH_SafeStringUsesArena) {
+  SafeString small(100, 'a');
+  SafeString large(passport::detail::SecureArena::kMaxChunkSize * 2, 'b');
+  EXPECT_LE(1, passport::detail::SecureArena::Instance().GetRegionCount());
+  SafeString copy(small + large);
+  EXPECT_EQ(small, copy.substr(0, small.size()));
+  EXPECT_EQ(large, copy.substr(small.size()));
+}
+
 TEST(SecureStringTest, BEH_CreateSecureString) {
   SecureString secure_string;
 
@@ -59,6 +306,18 @@ TEST(SecureStringTest, BEH_HashSecureStringString) {
   BoundedString hash(crypto::Hash<crypto::SHA512>(string));
 }
 
+TEST(SecureStringTest, BEH_InputCipher) {
+  passport::detail::InputCipher cipher, other_cipher;
+  const std::string kChars(RandomString(20 + RandomUint32() % 100));
+  SafeString encrypted(cipher.Encrypt(kChars.data(), kChars.size()));
+  EXPECT_EQ(SafeString(kChars.begin(), kChars.end()), cipher.Decrypt(encrypted));
+  // Every encryption uses a fresh nonce, and every instance a fresh key
+  EXPECT_NE(encrypted, cipher.Encrypt(kChars.data(), kChars.size()));
+  EXPECT_NE(SafeString(kChars.begin(), kChars.end()), other_cipher.Decrypt(encrypted));
+  EXPECT_TRUE(cipher.Decrypt(cipher.Encrypt(kChars.data(), 0)).empty());
+  EXPECT_THROW(cipher.Decrypt(SafeString(3, 'a')), std::exception);
+}
+
 TEST(SecureStringTest, BEH_CreatePassword) {
   Password password;
 
@@ -82,6 +341,30 @@ TEST(SecureStringTest, BEH_CreatePassword) {
   ASSERT_EQ(SafeString("payload"), password.string());
 }
 
+TEST(SecureStringTest, BEH_EditLongPassword) {
+  // Mimics typing with the cursor moved around, checked against an unprotected copy
+  Password password;
+  std::string expected;
+  size_t cursor(0);
+  for (int i(0); i != 1000; ++i) {
+    if (RandomUint32() % 10 == 0)
+      cursor = RandomUint32() % (expected.size() + 1);
+    if (cursor != 0 && RandomUint32() % 4 == 0) {
+      --cursor;
+      EXPECT_NO_THROW(password.Remove(cursor));
+      expected.erase(cursor, 1);
+    } else {
+      char typed(RandomAlphaNumericString(1)[0]);
+      EXPECT_NO_THROW(password.Insert(cursor, typed));
+      expected.insert(cursor++, 1, typed);
+    }
+  }
+  EXPECT_THROW(password.Remove(expected.size()), std::exception);
+  EXPECT_THROW(password.Remove(0, expected.size() + 1), std::exception);
+  EXPECT_NO_THROW(password.Finalise());
+  ASSERT_EQ(SafeString(expected.begin(), expected.end()), password.string());
+}
+
 TEST(SecureStringTest, BEH_CreatePasswordString) {
   SafeString safe_password("password");
   EXPECT_NO_THROW(Password password(safe_password));
@@ -294,6 +577,49 @@ TEST(SecureStringTest, BEH_CheckPasswordValidForAllChars) {
   EXPECT_NO_THROW(password.Finalise());
 }
 
+TEST(SecureStringTest, BEH_CharacterValidator) {
+  for (const char* pattern : {".", "[a-z]", "\\d|[A-F]", "^[[:punct:]]$", "(?![aeiou])[a-z]"}) {
+    boost::regex regex(pattern);
+    passport::detail::CharacterValidator validator(regex);
+    for (int i(0); i != 256; ++i) {
+      const char character(static_cast<char>(i));
+      EXPECT_EQ(boost::regex_search(std::string(1, character), regex), validator.IsValid(character))
+          << pattern << " " << i;
+    }
+  }
+
+  passport::detail::CharacterValidator validator(
+      passport::detail::CharacterValidator::Cached(boost::regex("[0-9]")));
+  EXPECT_TRUE(validator.IsValid("0123456789", 10));
+  EXPECT_FALSE(validator.IsValid("01234a6789", 10));
+  EXPECT_TRUE(validator.IsValid("", 0));
+
+  Pin pin;
+  EXPECT_NO_THROW(pin.Insert(0, std::string("12")));
+  EXPECT_NO_THROW(pin.Insert(2, '3'));
+  EXPECT_TRUE(pin.IsValid(boost::regex("[0-9]")));
+  EXPECT_TRUE(pin.IsValid(validator));
+  EXPECT_NO_THROW(pin.Insert(1, 'x'));
+  EXPECT_FALSE(pin.IsValid(boost::regex("[0-9]")));
+  EXPECT_FALSE(pin.IsValid(validator));
+  EXPECT_NO_THROW(pin.Finalise());
+  EXPECT_FALSE(pin.IsValid(validator));
+  EXPECT_TRUE(pin.IsValid(boost::regex("[0-9x]")));
+  EXPECT_NO_THROW(pin.Remove(1));
+  EXPECT_NO_THROW(pin.Finalise());
+  EXPECT_TRUE(pin.IsValid(validator));
+
+  // While editing, an entry inserted as several characters is matched as a whole; once finalised,
+  // every character is matched separately
+  Password password;
+  EXPECT_NO_THROW(password.Insert(0, std::string("ab")));
+  EXPECT_TRUE(password.IsValid(boost::regex("ab")));
+  EXPECT_FALSE(password.IsValid(boost::regex("^[a-z]$")));
+  EXPECT_NO_THROW(password.Finalise());
+  EXPECT_FALSE(password.IsValid(boost::regex("ab")));
+  EXPECT_TRUE(password.IsValid(boost::regex("^[a-z]$")));
+}
+
 TEST(SecureStringTest, BEH_CreatePin) {
   Pin pin;
 
@@ -308,6 +634,30 @@ TEST(SecureStringTest, BEH_CreatePin) {
   ASSERT_EQ(123, pin.Value());
 }
 
+TEST(SecureStringTest, BEH_CachedPinValueAndHash) {
+  Pin pin(std::string("1234"));
+  auto hash(pin.Hash<crypto::SHA512>());
+  EXPECT_EQ(crypto::Hash<crypto::SHA512>(std::string("1234")).string(),
+            std::string(hash.string().begin(), hash.string().end()));
+  EXPECT_EQ(1234, pin.Value());
+  EXPECT_EQ(hash, pin.Hash<crypto::SHA512>());
+  EXPECT_EQ(1234, pin.Value());
+
+  // Modifying the pin discards the cached results
+  EXPECT_NO_THROW(pin.Insert(4, '5'));
+  EXPECT_THROW(pin.Value(), std::exception);
+  EXPECT_THROW(pin.Hash<crypto::SHA512>(), std::exception);
+  EXPECT_NO_THROW(pin.Finalise());
+  EXPECT_EQ(12345, pin.Value());
+  EXPECT_NE(hash, pin.Hash<crypto::SHA512>());
+  EXPECT_NO_THROW(pin.Remove(4));
+  EXPECT_NO_THROW(pin.Finalise());
+  EXPECT_EQ(1234, pin.Value());
+  EXPECT_EQ(hash, pin.Hash<crypto::SHA512>());
+  pin.Clear();
+  EXPECT_THROW(pin.Value(), std::exception);
+}
+
 TEST(SecureStringTest, BEH_CreateInvalidLengthPin) {
   {
     Pin pin;
@@ -0,0 +1,149 @@
+/*  Copyright 2013 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/passport/detail/signature_scheme.h"
+
+#include <future>
+#include <vector>
+
+#include "maidsafe/common/test.h"
+#include "maidsafe/common/utils.h"
+
+#include "maidsafe/passport/types.h"
+#include "maidsafe/passport/detail/passport.pb.h"
+
+
+namespace maidsafe {
+namespace passport {
+namespace detail {
+
+// A self-signed identity type using ECDSA, to exercise fobs of a non-RSA scheme.
+typedef maidsafe::detail::Tag<static_cast<DataTagValue>(0xFFFF)> EcdsaTestTag;
+
+template<>
+struct is_self_signed<EcdsaTestTag> : public std::true_type {};
+
+template<>
+struct SignatureScheme<EcdsaTestTag> {
+  typedef EcdsaScheme type;
+};
+
+namespace test {
+
+template<typename Scheme>
+void CheckScheme() {
+  auto keys(Scheme::GenerateKeyPair());
+  auto other_keys(Scheme::GenerateKeyPair());
+  asymm::PlainText data(RandomString(1 + RandomUint32() % 1000));
+
+  asymm::Signature signature(Scheme::Sign(data, keys.private_key));
+  EXPECT_TRUE(Scheme::CheckSignature(data, signature, keys.public_key));
+  EXPECT_FALSE(Scheme::CheckSignature(data, signature, other_keys.public_key));
+  EXPECT_FALSE(Scheme::CheckSignature(asymm::PlainText(RandomString(10)), signature,
+                                      keys.public_key));
+
+  EXPECT_TRUE(Scheme::MatchingKeys(keys.private_key, keys.public_key));
+  EXPECT_FALSE(Scheme::MatchingKeys(keys.private_key, other_keys.public_key));
+
+  auto private_key(Scheme::DecodePrivateKey(Scheme::EncodeKey(keys.private_key)));
+  auto public_key(Scheme::DecodePublicKey(Scheme::EncodeKey(keys.public_key)));
+  EXPECT_TRUE(Scheme::MatchingKeys(private_key, public_key));
+  EXPECT_TRUE(Scheme::CheckSignature(data, Scheme::Sign(data, private_key), keys.public_key));
+  EXPECT_THROW(Scheme::DecodePublicKey(NonEmptyString(RandomString(100))), std::exception);
+
+  CachedSigner<Scheme> signer;
+  CachedVerifier<Scheme> verifier;
+  verifier.Precompute(keys.public_key);
+  std::vector<std::future<bool>> results;
+  for (int i(0); i != 10; ++i) {
+    results.push_back(std::async(std::launch::async, [&] {
+      return verifier.Verify(keys.public_key, data, signer.Sign(keys.private_key, data));
+    }));
+  }
+  for (auto& result : results)
+    EXPECT_TRUE(result.get());
+  EXPECT_FALSE(verifier.Verify(keys.public_key, data,
+                               Scheme::Sign(data, other_keys.private_key)));
+
+  // The digest is taken from the signing pass and signatures remain interchangeable
+  const crypto::SHA512Hash kDigest(crypto::Hash<crypto::SHA512>(data));
+  crypto::SHA512Hash signer_digest, verifier_digest;
+  signature = signer.Sign(keys.private_key, data, signer_digest);
+  EXPECT_EQ(kDigest, signer_digest);
+  EXPECT_TRUE(verifier.Verify(keys.public_key, data, signature));
+  EXPECT_TRUE(verifier.Verify(keys.public_key, data, Scheme::Sign(data, keys.private_key),
+                              verifier_digest));
+  EXPECT_EQ(kDigest, verifier_digest);
+  verifier_digest = crypto::SHA512Hash();
+  EXPECT_FALSE(verifier.Verify(keys.public_key, data, Scheme::Sign(data, other_keys.private_key),
+                               verifier_digest));
+  EXPECT_EQ(kDigest, verifier_digest);
+}
+
+TEST(SignatureSchemeTest, BEH_Rsa) {
+  CheckScheme<RsaScheme>();
+  // Must be interchangeable with asymm
+  auto keys(asymm::GenerateKeyPair());
+  asymm::PlainText data(RandomString(100));
+  EXPECT_TRUE(asymm::CheckSignature(data, CachedSigner<RsaScheme>().Sign(keys.private_key, data),
+                                    keys.public_key));
+  EXPECT_TRUE(CachedVerifier<RsaScheme>().Verify(keys.public_key, data,
+                                                 asymm::Sign(data, keys.private_key)));
+}
+
+TEST(SignatureSchemeTest, BEH_Ecdsa) {
+  CheckScheme<EcdsaScheme>();
+}
+
+TEST(SignatureSchemeTest, BEH_EcdsaFob) {
+  typedef Fob<EcdsaTestTag> EcdsaFob;
+  typedef PublicFob<EcdsaTestTag> EcdsaPublicFob;
+  EcdsaFob fob;
+  EXPECT_EQ(CreateFobName(fob.public_key(), fob.validation_token()), fob.name().value);
+  EXPECT_TRUE(EcdsaScheme::CheckSignature(
+      asymm::PlainText(EcdsaScheme::EncodeKey(fob.public_key())), fob.validation_token(),
+      fob.public_key()));
+
+  protobuf::Fob proto_fob;
+  fob.ToProtobuf(&proto_fob);
+  EXPECT_EQ(static_cast<uint32_t>(SignatureSchemeId::kEcdsa), proto_fob.signature_scheme());
+  EcdsaFob parsed_fob(proto_fob);
+  EXPECT_EQ(fob.name(), parsed_fob.name());
+  EXPECT_EQ(fob.validation_token(), parsed_fob.validation_token());
+  EXPECT_TRUE(EcdsaScheme::MatchingKeys(parsed_fob.private_key(), fob.public_key()));
+
+  asymm::PlainText data(RandomString(100));
+  EcdsaPublicFob public_fob(fob);
+  EcdsaPublicFob parsed_public_fob(public_fob.name(), public_fob.Serialise());
+  EXPECT_TRUE(public_fob.Verify(data, fob.Sign(data)));
+  EXPECT_TRUE(parsed_public_fob.Verify(data, parsed_fob.Sign(data)));
+
+  // Fobs of one scheme can't be parsed as fobs of another
+  proto_fob.set_type(static_cast<uint32_t>(AnmidTag::kValue));
+  EXPECT_THROW(Anmid anmid(proto_fob), std::exception);
+  Anmid anmid;
+  anmid.ToProtobuf(&proto_fob);
+  EXPECT_FALSE(proto_fob.has_signature_scheme());
+  proto_fob.set_type(static_cast<uint32_t>(EcdsaTestTag::kValue));
+  EXPECT_THROW(EcdsaFob ecdsa_fob(proto_fob), std::exception);
+}
+
+}  // namespace test
+}  // namespace detail
+}  // namespace passport
+}  // namespace maidsafe